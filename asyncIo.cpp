@@ -0,0 +1,207 @@
+#include "asyncIo.h"
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include "util.h"
+
+static inline int ioUringSetup(uint32_t entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int ioUringEnter(int ring_fd, uint32_t to_submit, uint32_t min_complete,
+                               uint32_t flags) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+AsyncIo::AsyncIo(bool use_io_uring) {
+    if (use_io_uring && !setupIoUring(IO_URING_ENTRIES)) {
+        std::cout << "io_uring is not available, fall back to synchronous I/O.\n";
+    }
+}
+
+AsyncIo::~AsyncIo() {
+    if (ring_fd < 0) return;
+    {
+        std::unique_lock<std::mutex> lock(io_lock);
+        while (inflight_num > 0) {
+            waitCompletion(lock);
+        }
+    }
+    munmap(sqes, sq_entries * sizeof(struct io_uring_sqe));
+    if (cq_ptr != sq_ptr) munmap(cq_ptr, cq_ring_size);
+    munmap(sq_ptr, sq_ring_size);
+    close(ring_fd);
+}
+
+bool AsyncIo::setupIoUring(uint32_t entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = ioUringSetup(entries, &params);
+    if (fd < 0) {
+        return false;
+    }
+
+    sq_ring_size     = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size     = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+    sq_ptr = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                  IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    cq_ptr = sq_ptr;
+    if (!single_mmap) {
+        cq_ptr = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                      IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            munmap(sq_ptr, sq_ring_size);
+            close(fd);
+            return false;
+        }
+    }
+    sqes = (struct io_uring_sqe*)mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                      IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (!single_mmap) munmap(cq_ptr, cq_ring_size);
+        munmap(sq_ptr, sq_ring_size);
+        close(fd);
+        return false;
+    }
+
+    uint8_t* sq_base = (uint8_t*)sq_ptr;
+    uint8_t* cq_base = (uint8_t*)cq_ptr;
+    sq_head          = (unsigned*)(sq_base + params.sq_off.head);
+    sq_tail          = (unsigned*)(sq_base + params.sq_off.tail);
+    sq_mask          = (unsigned*)(sq_base + params.sq_off.ring_mask);
+    sq_array         = (unsigned*)(sq_base + params.sq_off.array);
+    cq_head          = (unsigned*)(cq_base + params.cq_off.head);
+    cq_tail          = (unsigned*)(cq_base + params.cq_off.tail);
+    cq_mask          = (unsigned*)(cq_base + params.cq_off.ring_mask);
+    cqes             = (struct io_uring_cqe*)(cq_base + params.cq_off.cqes);
+    sq_entries       = params.sq_entries;
+    ring_fd          = fd;
+    return true;
+}
+
+uint64_t AsyncIo::submitRead(int fd, uint64_t offset, void* buf, size_t size) {
+    std::unique_lock<std::mutex> lock(io_lock);
+    return submit(IORING_OP_READV, fd, offset, std::vector<struct iovec>{{buf, size}}, lock);
+}
+
+uint64_t AsyncIo::submitWrite(int fd, uint64_t offset, const std::vector<const void*>& bufs,
+                              size_t buf_size) {
+    std::vector<struct iovec> iovecs;
+    for (auto&& buf : bufs) {
+        iovecs.push_back(iovec{const_cast<void*>(buf), buf_size});
+    }
+    std::unique_lock<std::mutex> lock(io_lock);
+    return submit(IORING_OP_WRITEV, fd, offset, std::move(iovecs), lock);
+}
+
+uint64_t AsyncIo::submit(uint8_t opcode, int fd, uint64_t offset,
+                         std::vector<struct iovec>&& iovecs, std::unique_lock<std::mutex>& lock) {
+    uint64_t ticket = next_ticket++;
+
+    if (ring_fd < 0) {
+        ssize_t bytes = opcode == IORING_OP_READV
+                            ? preadv(fd, iovecs.data(), (int)iovecs.size(), (off_t)offset)
+                            : pwritev(fd, iovecs.data(), (int)iovecs.size(), (off_t)offset);
+        completed[ticket] = bytes < 0 ? -errno : (int32_t)bytes;
+        return ticket;
+    }
+
+    // the completion queue must never overflow, so keep at most sq_entries requests in flight.
+    while (inflight_num >= sq_entries) {
+        waitCompletion(lock);
+    }
+
+    // the iovec array has to stay valid until the request completes.
+    std::vector<struct iovec>& target_iovecs = inflight_iovecs[ticket];
+    target_iovecs.swap(iovecs);
+
+    unsigned tail            = *sq_tail;
+    unsigned index           = tail & *sq_mask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode     = opcode;
+    sqe->fd         = fd;
+    sqe->off        = offset;
+    sqe->addr       = (uint64_t)target_iovecs.data();
+    sqe->len        = (uint32_t)target_iovecs.size();
+    sqe->user_data  = ticket;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int ret;
+    do {
+        ret = ioUringEnter(ring_fd, 1, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        debug_error("io_uring_enter error at submit.\n");
+    }
+    ++inflight_num;
+    return ticket;
+}
+
+void AsyncIo::reapCompletions() {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+        completed[cqe->user_data] = cqe->res;
+        inflight_iovecs.erase(cqe->user_data);
+        --inflight_num;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+void AsyncIo::waitCompletion(std::unique_lock<std::mutex>& lock) {
+    // only one thread sleeps in io_uring_enter, the others wait for it to reap.
+    if (reaping) {
+        io_cv.wait(lock);
+        return;
+    }
+    reaping = true;
+    lock.unlock();
+    int ret;
+    do {
+        ret = ioUringEnter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+    } while (ret < 0 && errno == EINTR);
+    lock.lock();
+    if (ret < 0) {
+        debug_error("io_uring_enter error at waitCompletion.\n");
+    }
+    reapCompletions();
+    reaping = false;
+    io_cv.notify_all();
+}
+
+int32_t AsyncIo::wait(uint64_t ticket) {
+    std::unique_lock<std::mutex> lock(io_lock);
+    for (;;) {
+        auto target = completed.find(ticket);
+        if (target != completed.end()) {
+            int32_t result = target->second;
+            completed.erase(target);
+            return result;
+        }
+        waitCompletion(lock);
+    }
+}
+
+bool AsyncIo::poll(uint64_t ticket) {
+    std::lock_guard<std::mutex> guard(io_lock);
+    if (ring_fd >= 0 && !reaping) {
+        reapCompletions();
+    }
+    return completed.contains(ticket);
+}
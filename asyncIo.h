@@ -0,0 +1,64 @@
+#ifndef _ASYNC_IO_H_
+#define _ASYNC_IO_H_
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+const uint32_t IO_URING_ENTRIES = 256;
+
+/*
+    AsyncIo submits page reads and writes and returns a ticket for each request.
+    wait(ticket) blocks until the request has finished and returns its result (bytes or -errno).
+    With --io-uring the requests go through an io_uring instance set up with raw syscalls,
+    otherwise (or when io_uring is not available) they are done synchronously with
+    preadv/pwritev at submission, and wait() only returns the stored result.
+*/
+class AsyncIo {
+   public:
+    explicit AsyncIo(bool use_io_uring);
+    virtual ~AsyncIo();
+    uint64_t submitRead(int fd, uint64_t offset, void* buf, size_t size);
+    uint64_t submitWrite(int fd, uint64_t offset, const std::vector<const void*>& bufs,
+                         size_t buf_size);
+    int32_t wait(uint64_t ticket);
+    bool poll(uint64_t ticket);
+    inline bool isIoUring() const { return ring_fd >= 0; }
+
+   private:
+    std::mutex io_lock;  // protects the rings and the maps below
+    std::condition_variable io_cv;
+    bool reaping          = false;
+    uint64_t next_ticket  = 1;
+    uint32_t inflight_num = 0;
+    std::unordered_map<uint64_t, int32_t> completed;
+    std::unordered_map<uint64_t, std::vector<struct iovec>> inflight_iovecs;
+
+    // io_uring state, ring_fd is -1 for the synchronous fallback
+    int ring_fd               = -1;
+    void* sq_ptr              = nullptr;
+    void* cq_ptr              = nullptr;
+    size_t sq_ring_size       = 0;
+    size_t cq_ring_size       = 0;
+    struct io_uring_sqe* sqes = nullptr;
+    uint32_t sq_entries       = 0;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    bool setupIoUring(uint32_t entries);
+    uint64_t submit(uint8_t opcode, int fd, uint64_t offset, std::vector<struct iovec>&& iovecs,
+                    std::unique_lock<std::mutex>& lock);
+    void reapCompletions();
+    void waitCompletion(std::unique_lock<std::mutex>& lock);
+};
+
+#endif
@@ -2,24 +2,47 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <ext/stdio_filebuf.h>
+#include <map>
 #include <memory>
 #include <random>
+#include <tuple>
 #include <typeinfo>
 #include <vector>
+#include "checksum.h"
 #include "util.h"
 
 extern bool PRODUCTION;
+extern uint32_t BUFFER_POOL_PAGES;
+extern bool HUGE_PAGES;
+extern uint32_t BGWRITER_DELAY_MS;
+extern uint32_t BGWRITER_LRU_MAXPAGES;
+extern float BGWRITER_LRU_MULTIPLIER;
+extern uint32_t CHECKPOINT_TIMEOUT_S;
+extern float CHECKPOINT_COMPLETION_TARGET;
+extern uint32_t CHECKPOINT_WAL_SIZE_MB;
+extern bool USE_IO_URING;
+extern bool DIRECT_IO;
+extern bool MMAP_READS;
+extern bool BUFFER_STATS;
+extern ChecksumVerifyMode CHECKSUM_VERIFY;
+extern bool PAX_PAGES;
+extern bool FIXED_TUPLES;
 
 const uint16_t UINT16_BYTE_SIZE = 2;
 std::string PROJECT_PATH        = "/home/masashi/workspace/db/untrust-dbms/";
 const char* SCHEMA_FILE_NAME    = "SCHEMA";
+const char* WAL_FILE_NAME       = "WAL";
+const char* CONTROL_FILE_NAME   = "CONTROL";
 
 inline bool BufferTag::operator==(const BufferTag& rhs) const {
     const BufferTag& lhs = *this;
@@ -29,27 +52,464 @@ inline bool BufferTag::operator==(const BufferTag& rhs) const {
 
 inline bool BufferTag::operator!=(const BufferTag& rhs) const { return !(*this == rhs); }
 
+static inline uint64_t hashMix64(uint64_t x) {
+    // finalizer of MurmurHash3
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
 inline std::size_t BufferTag::Hash::operator()(const BufferTag& key) const {
-    std::size_t h1 = std::hash<Oid>()(key.db_node);
-    std::size_t h2 = std::hash<Oid>()(key.rel_node);
-    std::size_t h3 = std::hash<int>()(key.fd);
-    std::size_t h4 = std::hash<uint64_t>()(key.heap_file_block_id);
-    return h1 ^ h2 ^ h3 ^ h4;
+    // every field compared by operator== is mixed in. the fork and segment files share the
+    // rel_node of their table, and only fd tells their blocks apart.
+    uint64_t h = hashMix64(key.heap_file_block_id);
+    h          = hashMix64(h ^ key.rel_node);
+    h          = hashMix64(h ^ key.db_node);
+    h          = hashMix64(h ^ (uint64_t)(uint32_t)key.fd);
+    return h;
+}
+
+static inline void countStat(std::atomic<uint64_t>& counter, uint64_t value = 1) {
+    counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+static uint64_t pageChecksum(const BufferPage* page, uint64_t block_id) {
+    // the block number is included, so that a page written to another block is detected.
+    const uint8_t* page_ptr = (const uint8_t*)page;
+    size_t checksum_start   = offsetof(HeapHeaderInfo, pd_checksum);
+    size_t checksum_end     = checksum_start + sizeof(page->heap_header_info.pd_checksum);
+    uint32_t crc            = crc32c(&block_id, sizeof(block_id));
+    crc                     = crc32c(page_ptr, checksum_start, crc);
+    crc = crc32c(page_ptr + checksum_end, PAGE_TABLE_SIZE - checksum_end, crc);
+    return PAGE_CHECKSUM_VALID | crc;
+}
+
+static void initPage(BufferPage* page) {
+    // set default HeapHeaderInfo
+    *page                              = {0};
+    page->heap_header_info.pd_lsn      = 0;
+    page->heap_header_info.pd_checksum = 0;
+    page->heap_header_info.pd_lower    = sizeof(HeapHeaderInfo);
+    page->heap_header_info.pd_upper    = PAGE_TABLE_SIZE;
+    page->heap_header_info.pd_special  = 0;
+}
+
+static bool setFixedOffsets(const std::vector<std::shared_ptr<ColumnTuple>>& column_tuple_list) {
+    // lay the fields out back to back. false if some column has no fixed width, or if a tuple
+    // and its line pos would not fit in a page.
+    uint32_t offset = 0;
+    for (auto&& column_tuple : column_tuple_list) {
+        if (column_tuple->type_size == 0) {
+            return false;
+        }
+        column_tuple->fixed_offset = (uint16_t)std::min<uint32_t>(offset, UINT16_MAX);
+        offset += column_tuple->type_size;
+    }
+    return offset + UINT16_BYTE_SIZE <= HEAP_CONTENT_SIZE;
+}
+
+static inline uint16_t fixedTupleSize(
+    const std::vector<std::shared_ptr<ColumnTuple>>& column_tuple_list) {
+    return column_tuple_list.back()->fixed_offset + column_tuple_list.back()->type_size;
+}
+
+static void fillFixedTuple(uint8_t* tuple_ptr,
+                           const std::vector<std::shared_ptr<ColumnTuple>>& column_tuple_list,
+                           ValueList* value_list) {
+    // copy every value to its offset, and pad the rest of the field with zeros
+    memset(tuple_ptr, 0, fixedTupleSize(column_tuple_list));
+    ValueList* target_value = value_list;
+    for (auto&& column_tuple : column_tuple_list) {
+        memcpy(tuple_ptr + column_tuple->fixed_offset, target_value->binary_data,
+               target_value->data_size);
+        target_value = target_value->next;
+    }
+}
+
+static void paxInsertTuple(BufferPage* page,
+                           const std::vector<std::shared_ptr<ColumnTuple>>& column_tuple_list,
+                           const uint8_t* tuple_ptr) {
+    // split a fixed-width tuple into the minipages. the caller has checked the free space.
+    uint16_t tuple_size              = fixedTupleSize(column_tuple_list);
+    uint16_t capacity                = (uint16_t)(HEAP_CONTENT_SIZE / tuple_size);
+    HeapHeaderInfo& heap_header_info = page->heap_header_info;
+    if (heap_header_info.pd_lower == sizeof(HeapHeaderInfo)) {
+        heap_header_info.pd_upper = (uint16_t)(sizeof(HeapHeaderInfo) + capacity * tuple_size);
+    }
+    uint16_t slot = (uint16_t)((heap_header_info.pd_lower - sizeof(HeapHeaderInfo)) / tuple_size);
+    uint8_t* minipage = page->heap_content;
+    for (auto&& column_tuple : column_tuple_list) {
+        memcpy(minipage + capacity * column_tuple->fixed_offset + slot * column_tuple->type_size,
+               tuple_ptr + column_tuple->fixed_offset, column_tuple->type_size);
+    }
+    heap_header_info.pd_lower += tuple_size;
+}
+
+static inline std::string columnSegmentName(const char* table_name, size_t column_id) {
+    // column_id is 0-index, the file names are 1-index as the field ids.
+    return std::string(table_name) + COLUMN_SEGMENT_SUFFIX + std::to_string(column_id + 1);
+}
+
+static inline uint16_t varintSize(uint32_t value) {
+    uint16_t size = 1;
+    for (; value >= 0x80; value >>= 7) ++size;
+    return size;
+}
+
+static inline uint8_t* putVarint(uint8_t* ptr, uint32_t value) {
+    for (; value >= 0x80; value >>= 7) *ptr++ = (uint8_t)(value | 0x80);
+    *ptr++ = (uint8_t)value;
+    return ptr;
+}
+
+static inline const uint8_t* getVarint(const uint8_t* ptr, uint32_t* value) {
+    *value = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+        *value |= (uint32_t)(*ptr & 0x7F) << shift;
+        if (!(*ptr++ & 0x80)) return ptr;
+    }
+}
+
+// the delta of two INTEGER values, zigzag encoded so that a small negative delta is small too.
+static inline uint32_t zigzagDelta(int32_t value, int32_t base) {
+    int32_t delta = (int32_t)((uint32_t)value - (uint32_t)base);
+    return ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+}
+
+static inline int32_t addZigzagDelta(int32_t base, uint32_t encoded) {
+    uint32_t delta = (encoded >> 1) ^ (0U - (encoded & 1));
+    return (int32_t)((uint32_t)base + delta);
+}
+
+static inline ColumnBlockHeader columnBlockHeader(const BufferPage* page) {
+    // an empty block has no header yet, and holds no rows.
+    if (page->heap_header_info.pd_lower == sizeof(HeapHeaderInfo)) {
+        return ColumnBlockHeader{0, 0, 0, 0};
+    }
+    return *(const ColumnBlockHeader*)page->heap_content;
+}
+
+static bool extendsLastRun(const BufferPage* page, const ColumnTuple* column,
+                           const uint8_t* field) {
+    // whether the value is the one of the last run, and the run can take one more.
+    if (page->heap_header_info.pd_lower == sizeof(HeapHeaderInfo)) {
+        return false;
+    }
+    const ColumnBlockHeader* block_header = (const ColumnBlockHeader*)page->heap_content;
+    const uint8_t* run_ptr                = (const uint8_t*)page + block_header->last_run_pos;
+    uint16_t run_length;
+    memcpy(&run_length, run_ptr, sizeof(uint16_t));
+    if (run_length == UINT16_MAX) {
+        return false;
+    }
+    if (column->type == DataType::INT) {
+        int32_t value;
+        memcpy(&value, field, sizeof(int32_t));
+        return value == block_header->last_value;
+    }
+    uint32_t length;
+    const uint8_t* value_ptr = getVarint(run_ptr + UINT16_BYTE_SIZE, &length);
+    return length == strnlen((const char*)field, column->type_size) &&
+           !memcmp(value_ptr, field, length);
+}
+
+static uint16_t columnAppendSize(const BufferPage* page, const ColumnTuple* column,
+                                 const uint8_t* field) {
+    // bytes of free space which columnAppend takes from the block.
+    if (extendsLastRun(page, column, field)) {
+        return 0;
+    }
+    bool empty_block = page->heap_header_info.pd_lower == sizeof(HeapHeaderInfo);
+    uint16_t value_size;
+    if (column->type == DataType::INT) {
+        int32_t value;
+        memcpy(&value, field, sizeof(int32_t));
+        int32_t base = empty_block ? 0 : ((const ColumnBlockHeader*)page->heap_content)->last_value;
+        value_size   = varintSize(zigzagDelta(value, base));
+    } else {
+        uint32_t length = (uint32_t)strnlen((const char*)field, column->type_size);
+        value_size      = (uint16_t)(varintSize(length) + length);
+    }
+    return (uint16_t)((empty_block ? sizeof(ColumnBlockHeader) : 0) + UINT16_BYTE_SIZE +
+                      value_size);
+}
+
+static void columnAppend(BufferPage* page, const ColumnTuple* column, const uint8_t* field,
+                         uint64_t row_id) {
+    // append the value of row row_id, a field of a fixed-width tuple, to the block. the caller
+    // has checked the free space with columnAppendSize and that the row follows the block.
+    HeapHeaderInfo& heap_header_info = page->heap_header_info;
+    ColumnBlockHeader* block_header  = (ColumnBlockHeader*)page->heap_content;
+    uint8_t* page_ptr                = (uint8_t*)page;
+    if (extendsLastRun(page, column, field)) {
+        uint16_t run_length;
+        memcpy(&run_length, page_ptr + block_header->last_run_pos, sizeof(uint16_t));
+        ++run_length;
+        memcpy(page_ptr + block_header->last_run_pos, &run_length, sizeof(uint16_t));
+        ++block_header->row_num;
+        return;
+    }
+    if (heap_header_info.pd_lower == sizeof(HeapHeaderInfo)) {
+        *block_header = ColumnBlockHeader{row_id, 0, 0, 0};
+        heap_header_info.pd_lower += sizeof(ColumnBlockHeader);
+    }
+    uint8_t* run_ptr    = page_ptr + heap_header_info.pd_lower;
+    uint16_t run_length = 1;
+    memcpy(run_ptr, &run_length, sizeof(uint16_t));
+    uint8_t* value_ptr = run_ptr + UINT16_BYTE_SIZE;
+    if (column->type == DataType::INT) {
+        int32_t value;
+        memcpy(&value, field, sizeof(int32_t));
+        value_ptr = putVarint(value_ptr, zigzagDelta(value, block_header->last_value));
+        block_header->last_value = value;
+    } else {
+        uint32_t length = (uint32_t)strnlen((const char*)field, column->type_size);
+        value_ptr       = putVarint(value_ptr, length);
+        memcpy(value_ptr, field, length);
+        value_ptr += length;
+    }
+    block_header->last_run_pos = heap_header_info.pd_lower;
+    heap_header_info.pd_lower  = (uint16_t)(value_ptr - page_ptr);
+    ++block_header->row_num;
+}
+
+static void decodeColumnBlock(const BufferPage* page, const ColumnTuple* column,
+                              uint32_t row_num, uint8_t* values) {
+    // write the first row_num values of the block at type_size intervals. values is zero
+    // filled, so a CHAR(n) value is padded as in a fixed-width tuple.
+    const uint8_t* page_ptr = (const uint8_t*)page;
+    const uint8_t* run_ptr  = page_ptr + sizeof(HeapHeaderInfo) + sizeof(ColumnBlockHeader);
+    const uint8_t* runs_end = page_ptr + page->heap_header_info.pd_lower;
+    int32_t value           = 0;
+    while (run_ptr < runs_end && row_num > 0) {
+        uint16_t run_length;
+        memcpy(&run_length, run_ptr, sizeof(uint16_t));
+        uint32_t encoded;
+        const uint8_t* value_ptr = getVarint(run_ptr + UINT16_BYTE_SIZE, &encoded);
+        const uint8_t* data      = value_ptr;
+        uint32_t size            = encoded;
+        if (column->type == DataType::INT) {
+            value = addZigzagDelta(value, encoded);
+            data  = (const uint8_t*)&value;
+            size  = sizeof(int32_t);
+        }
+        run_ptr = value_ptr + (column->type == DataType::INT ? 0 : size);
+        for (uint16_t i = 0; i < run_length && row_num > 0; i++, row_num--) {
+            memcpy(values, data, size);
+            values += column->type_size;
+        }
+    }
+}
+
+static inline uint32_t bufRefCount(uint32_t state) { return state & BUF_REFCOUNT_MASK; }
+
+static inline uint32_t bufUsageCount(uint32_t state) {
+    return (state & BUF_USAGECOUNT_MASK) >> BUF_USAGECOUNT_SHIFT;
+}
+
+static uint32_t waitBufferHeaderUnlocked(BufferDescriptor& descriptor) {
+    uint32_t state = descriptor.state.load();
+    while (state & BM_LOCKED) {
+        std::this_thread::yield();
+        state = descriptor.state.load();
+    }
+    return state;
+}
+
+// the header lock is held only for a few instructions, so it is a spin lock in the state word.
+static uint32_t lockBufferHeader(BufferDescriptor& descriptor) {
+    for (;;) {
+        uint32_t state = descriptor.state.fetch_or(BM_LOCKED, std::memory_order_acquire);
+        if (!(state & BM_LOCKED)) {
+            return state | BM_LOCKED;
+        }
+        waitBufferHeaderUnlocked(descriptor);
+    }
+}
+
+static inline void unlockBufferHeader(BufferDescriptor& descriptor, uint32_t state) {
+    descriptor.state.store(state & ~BM_LOCKED, std::memory_order_release);
+}
+
+BufferTable::BufferTable(uint32_t buffer_num, const BufferDescriptor* descriptors)
+    : buffer_descriptor(descriptors) {
+    // twice the average number of entries, a partition that gets 3/4 full is grown.
+    uint32_t slot_num = 8;
+    while (slot_num < 2 * buffer_num / NUM_BUFFER_PARTITIONS) slot_num <<= 1;
+    for (auto&& partition : partitions) {
+        partition.slots.assign(slot_num, BufferTableSlot{0, 0});
+    }
+}
+
+int64_t BufferTable::lookup(const BufferTag& buffer_tag, uint64_t hash) const {
+    const BufferTablePartition& partition = partitions[getPartitionId(hash)];
+    uint32_t mask                         = partition.slots.size() - 1;
+    uint32_t hash_code                    = (uint32_t)hash;
+    for (uint32_t i = hash_code & mask;; i = (i + 1) & mask) {
+        const BufferTableSlot& slot = partition.slots[i];
+        if (slot.buffer_id == 0) {
+            return -1;
+        }
+        if (slot.hash_code == hash_code &&
+            buffer_descriptor[slot.buffer_id - 1].tag == buffer_tag) {
+            return slot.buffer_id - 1;
+        }
+    }
+}
+
+void BufferTable::insert(const BufferTag& buffer_tag, uint64_t hash, BufferId buffer_id) {
+    BufferTablePartition& partition = partitions[getPartitionId(hash)];
+    if ((partition.entry_num + 1) * 4 > partition.slots.size() * 3) {
+        grow(partition);
+    }
+    uint32_t mask      = partition.slots.size() - 1;
+    uint32_t hash_code = (uint32_t)hash;
+    uint32_t i         = hash_code & mask;
+    for (; partition.slots[i].buffer_id != 0; i = (i + 1) & mask) {
+        assert(partition.slots[i].hash_code != hash_code ||
+               buffer_descriptor[partition.slots[i].buffer_id - 1].tag != buffer_tag);
+    }
+    partition.slots[i] = BufferTableSlot{hash_code, (uint32_t)buffer_id.id + 1};
+    ++partition.entry_num;
+}
+
+void BufferTable::erase(const BufferTag& buffer_tag, uint64_t hash) {
+    BufferTablePartition& partition = partitions[getPartitionId(hash)];
+    uint32_t mask                   = partition.slots.size() - 1;
+    uint32_t hash_code              = (uint32_t)hash;
+    uint32_t hole                   = hash_code & mask;
+    for (;; hole = (hole + 1) & mask) {
+        const BufferTableSlot& slot = partition.slots[hole];
+        if (slot.buffer_id == 0) {
+            debug_error("no data entry for target buffer tag.\n");
+        }
+        if (slot.hash_code == hash_code &&
+            buffer_descriptor[slot.buffer_id - 1].tag == buffer_tag) {
+            break;
+        }
+    }
+    // backward shift: move every following entry of the cluster whose home slot is not
+    // between the hole and itself into the hole.
+    for (uint32_t i = (hole + 1) & mask; partition.slots[i].buffer_id != 0; i = (i + 1) & mask) {
+        uint32_t home = partition.slots[i].hash_code & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            partition.slots[hole] = partition.slots[i];
+            hole                  = i;
+        }
+    }
+    partition.slots[hole] = BufferTableSlot{0, 0};
+    --partition.entry_num;
+}
+
+void BufferTable::grow(BufferTablePartition& partition) {
+    std::vector<BufferTableSlot> new_slots(partition.slots.size() * 2, BufferTableSlot{0, 0});
+    uint32_t mask = new_slots.size() - 1;
+    for (auto&& slot : partition.slots) {
+        if (slot.buffer_id == 0) continue;
+        uint32_t i = slot.hash_code & mask;
+        for (; new_slots[i].buffer_id != 0; i = (i + 1) & mask) {
+        }
+        new_slots[i] = slot;
+    }
+    partition.slots.swap(new_slots);
 }
 
 BufferManager::BufferManager()
-    : data_entry_hash({}),
-      buffer_table(new BufferTable()),
-      buffer_descriptor({}),
-      buffer_pool({}) {}
+    : page_nums(BUFFER_POOL_PAGES > 0 ? BUFFER_POOL_PAGES : DEFAULT_PAGE_NUMS),
+      buffer_pool_mapping_size(0),
+      buffer_descriptor(new BufferDescriptor[page_nums]()),
+      buffer_pool(allocateBufferPool(page_nums)),
+      buffer_table(new BufferTable(page_nums, buffer_descriptor)),
+      disk_manager(new DiskManager(PAGE_TABLE_SIZE, USE_IO_URING, DIRECT_IO, MMAP_READS)),
+      wal_manager(new WalManager((PROJECT_PATH + WAL_FILE_NAME).c_str(),
+                                 (PROJECT_PATH + CONTROL_FILE_NAME).c_str())) {
+    for (uint32_t i = 0; i < page_nums; i++) {
+        buffer_descriptor[i].state     = 0;
+        buffer_descriptor[i].stats     = nullptr;
+        buffer_descriptor[i].buffer_id = BufferId{i};
+        buffer_descriptor[i].io_ticket = 0;
+    }
+    if (BGWRITER_LRU_MAXPAGES > 0) {
+        bgwriter_thread = std::thread(&BufferManager::backgroundWriterMain, this);
+    }
+    if (CHECKPOINT_TIMEOUT_S > 0) {
+        checkpointer_thread = std::thread(&BufferManager::checkpointerMain, this);
+    }
+}
 
 BufferManager::~BufferManager() {
-    for (auto&& descriptor : buffer_descriptor) {
-        if (descriptor.flags == PageFlags::DIRTY) {
-            pageFlush((uint16_t)descriptor.buffer_id.id);
+    if (checkpointer_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(checkpointer_mutex);
+            checkpointer_shutdown = true;
+        }
+        checkpointer_cv.notify_one();
+        checkpointer_thread.join();
+    }
+    if (bgwriter_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(bgwriter_mutex);
+            bgwriter_shutdown = true;
+        }
+        bgwriter_cv.notify_one();
+        bgwriter_thread.join();
+    }
+    {
+        std::unique_lock<std::mutex> lock(buffer_io_lock);
+        while (!inflight_buffer_io.empty()) {
+            completeBufferIo(inflight_buffer_io.begin()->first, lock);
+        }
+    }
+    if (recovery_done) {
+        // the shutdown checkpoint leaves nothing to replay at the next startup.
+        createCheckpoint(true);
+    } else {
+        // the WAL was not replayed, so the redo point must stay where it is.
+        std::vector<uint32_t> dirty_buffer_ids;
+        for (uint32_t i = 0; i < page_nums; i++) {
+            if (pinDirtyBufferForWrite(BufferId{i})) {
+                dirty_buffer_ids.push_back(i);
+            }
         }
+        flushBuffers(dirty_buffer_ids, FlushReason::SHUTDOWN);
+        releaseWrittenBuffers(dirty_buffer_ids);
+    }
+    if (BUFFER_STATS) {
+        printBufferStats();
     }
     delete (buffer_table);
+    delete (disk_manager);
+    delete (wal_manager);
+    munmap(buffer_pool, buffer_pool_mapping_size);
+    delete[] (buffer_descriptor);
+}
+
+BufferPage* BufferManager::allocateBufferPool(uint32_t page_num) {
+    // the whole pool is one anonymous mapping, so every page is aligned to the OS page size.
+    // with HUGE_PAGES, try explicit huge pages first and fall back to transparent huge pages.
+    size_t pool_size = (size_t)page_num * sizeof(BufferPage);
+    void* pool       = MAP_FAILED;
+    if (HUGE_PAGES) {
+        buffer_pool_mapping_size =
+            (pool_size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        pool = mmap(NULL, buffer_pool_mapping_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (pool == MAP_FAILED) {
+        buffer_pool_mapping_size = pool_size;
+        pool = mmap(NULL, buffer_pool_mapping_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pool == MAP_FAILED) {
+            debug_error("Failed to allocate buffer pool.\n");
+        }
+        if (HUGE_PAGES) {
+            madvise(pool, buffer_pool_mapping_size, MADV_HUGEPAGE);
+        }
+    }
+    return (BufferPage*)pool;
 }
 
 void BufferManager::createDataFile(const char* table_name) {
@@ -63,102 +523,746 @@ void BufferManager::createDataFile(const char* table_name) {
     }
 }
 
-BufferId BufferManager::getDataEntry(BufferTag& buffer_tag) {
-    if (data_entry_hash.contains(buffer_tag)) {
-        auto bucket_slot_id    = data_entry_hash[buffer_tag];
-        auto target_data_entry = buffer_table->bucket_slots[bucket_slot_id];
-        for (;; target_data_entry = target_data_entry->data_entry) {
-            if (target_data_entry->tag == buffer_tag) break;
-            if (target_data_entry->data_entry == nullptr) {
-                debug_error("no data entry for target buffer tag.\n");
-            }
+PageGuard::PageGuard()
+    : buffer_manager(nullptr), buffer_id(BufferId{0}), lock_mode(BufferLockMode::UNLOCKED) {}
+
+PageGuard::PageGuard(BufferManager* buffer_manager_arg, BufferId buffer_id_arg)
+    : buffer_manager(buffer_manager_arg),
+      buffer_id(buffer_id_arg),
+      lock_mode(BufferLockMode::UNLOCKED) {}
+
+PageGuard::PageGuard(PageGuard&& other) noexcept
+    : buffer_manager(other.buffer_manager),
+      buffer_id(other.buffer_id),
+      lock_mode(other.lock_mode) {
+    other.buffer_manager = nullptr;
+    other.lock_mode      = BufferLockMode::UNLOCKED;
+}
+
+PageGuard& PageGuard::operator=(PageGuard&& other) noexcept {
+    if (this != &other) {
+        release();
+        buffer_manager       = other.buffer_manager;
+        buffer_id            = other.buffer_id;
+        lock_mode            = other.lock_mode;
+        other.buffer_manager = nullptr;
+        other.lock_mode      = BufferLockMode::UNLOCKED;
+    }
+    return *this;
+}
+
+PageGuard::~PageGuard() { release(); }
+
+void PageGuard::release() {
+    if (buffer_manager != nullptr) {
+        unlock();
+        buffer_manager->unpinBuffer(buffer_id);
+        buffer_manager = nullptr;
+    }
+}
+
+void PageGuard::lockShared() {
+    assert(buffer_manager != nullptr && lock_mode == BufferLockMode::UNLOCKED);
+    buffer_manager->buffer_descriptor[buffer_id.id].content_lock.lock_shared();
+    lock_mode = BufferLockMode::SHARED;
+}
+
+void PageGuard::lockExclusive() {
+    assert(buffer_manager != nullptr && lock_mode == BufferLockMode::UNLOCKED);
+    buffer_manager->buffer_descriptor[buffer_id.id].content_lock.lock();
+    lock_mode = BufferLockMode::EXCLUSIVE;
+}
+
+void PageGuard::unlock() {
+    std::shared_mutex& content_lock = buffer_manager->buffer_descriptor[buffer_id.id].content_lock;
+    if (lock_mode == BufferLockMode::SHARED) {
+        content_lock.unlock_shared();
+    } else if (lock_mode == BufferLockMode::EXCLUSIVE) {
+        content_lock.unlock();
+    }
+    lock_mode = BufferLockMode::UNLOCKED;
+}
+
+void PageGuard::markDirty() {
+    assert(buffer_manager != nullptr && lock_mode == BufferLockMode::EXCLUSIVE);
+    buffer_manager->markBufferDirty(buffer_id);
+}
+
+BufferPage* PageGuard::getPage() const {
+    assert(buffer_manager != nullptr);
+    return &buffer_manager->buffer_pool[buffer_id.id];
+}
+
+PageGuard BufferManager::fetchPage(BufferTag& buffer_tag, BufferAccessStrategy* strategy,
+                                   bool zero_page) {
+    // getDataEntry returns the buffer already pinned, and the guard adopts that pin.
+    // with zero_page, a page which is not in the pool is initialized instead of read.
+    BufferId buffer_id = getDataEntry(buffer_tag, strategy, zero_page);
+    waitBufferIo(buffer_id);
+    return PageGuard(this, buffer_id);
+}
+
+bool BufferManager::prefetchPage(BufferTag& buffer_tag, BufferAccessStrategy* strategy) {
+    // start reading the page without waiting for it, and return whether an I/O was needed.
+    // with io_uring the page is read into a buffer, which stays BM_IO_IN_PROGRESS until someone
+    // fetches it or the clock sweep finds the read finished. with synchronous I/O, reading
+    // here would block the caller, so only ask the kernel to read the block ahead.
+    uint64_t hash = BufferTag::Hash()(buffer_tag);
+    {
+        std::shared_lock<std::shared_mutex> partition_guard(buffer_table->getPartitionLock(hash));
+        if (buffer_table->lookup(buffer_tag, hash) >= 0) {
+            return false;
         }
-        return target_data_entry->buffer_id;
     }
+    if (disk_manager->getRelation(buffer_tag.fd)->disk_block_num <= buffer_tag.heap_file_block_id) {
+        return false;
+    }
+    if (!disk_manager->async_io->isIoUring() || disk_manager->isMmapReads()) {
+        disk_manager->adviseWillNeed(buffer_tag.fd, buffer_tag.heap_file_block_id, 1);
+        return true;
+    }
+    bool found;
+    BufferId buffer_id = setNewBufferDescriptor(buffer_tag, hash, strategy, &found);
+    if (!found) {
+        setPageToBufferPool(buffer_tag, &buffer_id, true);
+    }
+    // prefetch does not keep the pin
+    unpinBuffer(buffer_id);
+    return !found;
+}
 
-    // insert Tag and slot_id to buffer table
-    uint32_t target_tag_slot_id = buffer_table->next_slot_id;
-    BufferId buffer_id          = setNewBufferDescriptor(buffer_tag);
-    auto new_data_entry = std::make_shared<DataEntry>(DataEntry{buffer_tag, buffer_id, nullptr});
-    if (buffer_table->bucket_slots[target_tag_slot_id] == nullptr) {
-        buffer_table->bucket_slots[target_tag_slot_id] = new_data_entry;
-    } else {
-        auto cur_data_entry = buffer_table->bucket_slots[target_tag_slot_id];
-        for (; cur_data_entry->data_entry != nullptr;) {
-            cur_data_entry = cur_data_entry->data_entry;
+void BufferManager::readAhead(const BufferTag& buffer_tag, ReadAheadState* read_ahead,
+                              BufferAccessStrategy* strategy) {
+    RelationFile* relation_file = disk_manager->getRelation(buffer_tag.fd);
+    if (!read_ahead->started) {
+        disk_manager->adviseSequential(buffer_tag.fd);
+        read_ahead->started = true;
+    }
+    // never prefetch so far that prefetched pages evict each other before the scan reaches them.
+    // with a ring, prefetched pages must not take the ring slots of each other either.
+    uint32_t max_window = std::max(1u, std::min(MAX_READAHEAD_PAGES, page_nums / 4));
+    if (strategy != nullptr) {
+        max_window = std::max(1u, std::min(max_window, (uint32_t)strategy->ring.size() / 2));
+    }
+    read_ahead->next_block = std::max(read_ahead->next_block, buffer_tag.heap_file_block_id + 1);
+    while (read_ahead->next_block <= buffer_tag.heap_file_block_id + read_ahead->window &&
+           read_ahead->next_block < relation_file->disk_block_num) {
+        BufferTag prefetch_tag          = buffer_tag;
+        prefetch_tag.heap_file_block_id = read_ahead->next_block++;
+        if (prefetchPage(prefetch_tag, strategy)) {
+            read_ahead->window = std::min(read_ahead->window * 2, max_window);
+        } else if (read_ahead->window > 1) {
+            --read_ahead->window;
         }
-        auto last_data_entry        = cur_data_entry;
-        last_data_entry->data_entry = new_data_entry;
     }
+}
 
-    // insert Tag and slot_id to hash entry
-    auto target =
-        data_entry_hash.insert(std::pair<BufferTag, uint32_t>{buffer_tag, target_tag_slot_id});
+bool BufferManager::readMappedPage(const BufferTag& buffer_tag, BufferPage* page_copy) {
+    // a page in the buffer pool may be newer than the file, so only a page which is not in the
+    // pool is read from the mapping. it is copied under the partition lock, so that no one can
+    // load it into the pool and write it out in the meantime, and the copy is used after the
+    // lock is released, so that evictions into the partition do not wait for the reader.
+    uint64_t hash = BufferTag::Hash()(buffer_tag);
+    {
+        std::shared_lock<std::shared_mutex> partition_guard(buffer_table->getPartitionLock(hash));
+        if (buffer_table->lookup(buffer_tag, hash) >= 0) {
+            return false;
+        }
+        const uint8_t* page = disk_manager->mapPage(buffer_tag.fd, buffer_tag.heap_file_block_id);
+        if (page == nullptr) {
+            return false;
+        }
+        memcpy(page_copy, page, PAGE_TABLE_SIZE);
+    }
+    BufferStats* stats = getRelationStats(buffer_tag.fd);
+    countStat(stats->misses);
+    countStat(stats->read_bytes, PAGE_TABLE_SIZE);
+    verifyPageChecksum(page_copy, buffer_tag.heap_file_block_id, stats);
+    return true;
+}
 
-    if (!target.second) {
-        debug_error("new DataEntry failed.\n");
+std::unique_ptr<BufferAccessStrategy> BufferManager::getBulkReadStrategy(uint64_t table_page_num) {
+    if (table_page_num <= page_nums / 4) {
+        return nullptr;
     }
-    buffer_table->next_slot_id = (buffer_table->next_slot_id + 1) % BUCKET_SLOT_SIZE;
+    uint32_t ring_size = std::max(1u, std::min(BULKREAD_RING_PAGES, page_nums / 8));
+    return std::make_unique<BufferAccessStrategy>(ring_size);
+}
 
-    return buffer_id;
+BufferStats* BufferManager::getRelationStats(int fd) {
+    // called only when a buffer gets a new tag, the hit path uses BufferDescriptor::stats.
+    std::lock_guard<std::mutex> guard(stats_lock);
+    std::unique_ptr<BufferStats>& stats = relation_stats[fd];
+    if (stats == nullptr) {
+        stats                = std::make_unique<BufferStats>();
+        stats->relation_name = disk_manager->getRelation(fd)->relation_name;
+    }
+    return stats.get();
 }
 
-BufferId BufferManager::setNewBufferDescriptor(BufferTag& buffer_tag) {
-    struct TargetBufferDescriptor {
-       private:
-        uint16_t target_buffer_id   = -1;
-        uint64_t target_usage_count = __LONG_MAX__;
+bool BufferManager::verifyPageChecksum(const BufferPage* page, uint64_t block_id,
+                                       BufferStats* stats) {
+    // false if the reader must zero the page instead of using it. the free space map is only a
+    // hint and is not logged, so a torn page of it is rebuilt from scratch, not an error.
+    // a page written before checksums existed has pd_checksum 0 and is not verified.
+    if (CHECKSUM_VERIFY == ChecksumVerifyMode::OFF || page->heap_header_info.pd_checksum == 0 ||
+        page->heap_header_info.pd_checksum == pageChecksum(page, block_id)) {
+        return true;
+    }
+    countStat(stats->checksum_failures);
+    const std::string& relation_name = stats->relation_name;
+    if (relation_name.ends_with(FSM_FORK_SUFFIX)) {
+        printf("page checksum mismatch in block %lu of %s, zeroing it.\n", block_id,
+               relation_name.c_str());
+        return false;
+    }
+    printf("page checksum mismatch in block %lu of %s.\n", block_id, relation_name.c_str());
+    if (CHECKSUM_VERIFY == ChecksumVerifyMode::ERROR) {
+        debug_error("page checksum mismatch at verifyPageChecksum.\n");
+    }
+    return true;
+}
 
-       public:
-        void set(uint16_t id, uint64_t usage_count) {
-            target_buffer_id   = id;
-            target_usage_count = usage_count;
+std::vector<BufferStatsRow> BufferManager::getBufferStats() {
+    // one row per relation sorted by name, and the sum of every relation as the last row.
+    std::vector<BufferStatsRow> stats_rows;
+    BufferStatsRow total = BufferStatsRow{"total", 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    {
+        std::lock_guard<std::mutex> guard(stats_lock);
+        for (auto&& [fd, stats] : relation_stats) {
+            (void)(fd);
+            BufferStatsRow row = BufferStatsRow{
+                stats->relation_name,
+                stats->hits.load(std::memory_order_relaxed),
+                stats->misses.load(std::memory_order_relaxed),
+                stats->evictions.load(std::memory_order_relaxed),
+                stats->eviction_writes.load(std::memory_order_relaxed),
+                stats->bgwriter_writes.load(std::memory_order_relaxed),
+                stats->checkpoint_writes.load(std::memory_order_relaxed),
+                stats->read_bytes.load(std::memory_order_relaxed),
+                stats->write_bytes.load(std::memory_order_relaxed),
+                stats->checksum_failures.load(std::memory_order_relaxed),
+            };
+            total.hits += row.hits;
+            total.misses += row.misses;
+            total.evictions += row.evictions;
+            total.eviction_writes += row.eviction_writes;
+            total.bgwriter_writes += row.bgwriter_writes;
+            total.checkpoint_writes += row.checkpoint_writes;
+            total.read_bytes += row.read_bytes;
+            total.write_bytes += row.write_bytes;
+            total.checksum_failures += row.checksum_failures;
+            stats_rows.push_back(row);
         }
-        inline uint16_t read_id() { return target_buffer_id; }
-        inline uint64_t read_usage_count() { return target_usage_count; }
-    } victim_buffer_descriptor;
+    }
+    std::sort(stats_rows.begin(), stats_rows.end(),
+              [](const BufferStatsRow& lhs, const BufferStatsRow& rhs) {
+                  return lhs.relation_name < rhs.relation_name;
+              });
+    stats_rows.push_back(total);
+    return stats_rows;
+}
 
-    // find victim page
-    victim_buffer_descriptor.set(buffer_descriptor[0].buffer_id.id, buffer_descriptor[0].ref_count);
-    for (uint16_t i = 0; i < PAGE_NUMS; i++) {
-        if (buffer_descriptor[i].ref_count == 0) {
-            victim_buffer_descriptor.set(i, 1);
-            break;
+void BufferManager::printBufferStats() {
+    printf("buffer cache statistics (%u pages):\n", page_nums);
+    printf("%-20s %10s %10s %10s %16s %16s %18s %12s %12s %18s\n", "relation", "hits", "misses",
+           "evictions", "eviction_writes", "bgwriter_writes", "checkpoint_writes", "read_bytes",
+           "write_bytes", "checksum_failures");
+    for (auto&& row : getBufferStats()) {
+        printf("%-20s %10lu %10lu %10lu %16lu %16lu %18lu %12lu %12lu %18lu\n",
+               row.relation_name.c_str(), row.hits, row.misses, row.evictions, row.eviction_writes,
+               row.bgwriter_writes, row.checkpoint_writes, row.read_bytes, row.write_bytes,
+               row.checksum_failures);
+    }
+    auto [wal_record_num, wal_flush_num] = wal_manager->getCounts();
+    printf("wal: %lu records, %lu flushes, %lu checkpoints\n", wal_record_num, wal_flush_num,
+           wal_manager->getCheckpointNum());
+}
+
+void BufferManager::waitBufferIo(BufferId buffer_id) {
+    BufferDescriptor& descriptor = buffer_descriptor[buffer_id.id];
+    if (!(descriptor.state.load() & BM_IO_IN_PROGRESS)) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(buffer_io_lock);
+    while (descriptor.state.load() & BM_IO_IN_PROGRESS) {
+        if (inflight_buffer_io.contains(descriptor.io_ticket)) {
+            completeBufferIo(descriptor.io_ticket, lock);
+        } else {
+            // another thread is reading this page, or completing its read
+            buffer_io_cv.wait(lock);
         }
-        if (buffer_descriptor[i].ref_count > 0 &&
-            buffer_descriptor[i].usage_count < victim_buffer_descriptor.read_usage_count()) {
-            victim_buffer_descriptor.set(i, buffer_descriptor[i].usage_count);
+    }
+}
+
+void BufferManager::completeBufferIo(uint64_t io_ticket, std::unique_lock<std::mutex>& lock) {
+    auto target = inflight_buffer_io.find(io_ticket);
+    if (target == inflight_buffer_io.end()) {
+        return;
+    }
+    std::vector<uint32_t> buffer_ids = std::move(target->second);
+    inflight_buffer_io.erase(target);
+    lock.unlock();
+    int32_t result = disk_manager->async_io->wait(io_ticket);
+    lock.lock();
+    finishBufferIo(buffer_ids, result);
+}
+
+bool BufferManager::tryCompleteBufferIo(uint32_t buffer_id) {
+    std::lock_guard<std::mutex> guard(buffer_io_lock);
+    uint64_t io_ticket = buffer_descriptor[buffer_id].io_ticket;
+    auto target        = inflight_buffer_io.find(io_ticket);
+    if (target == inflight_buffer_io.end() || !disk_manager->async_io->poll(io_ticket)) {
+        return false;
+    }
+    std::vector<uint32_t> buffer_ids = std::move(target->second);
+    inflight_buffer_io.erase(target);
+    finishBufferIo(buffer_ids, disk_manager->async_io->wait(io_ticket));
+    return true;
+}
+
+void BufferManager::finishBufferIo(const std::vector<uint32_t>& buffer_ids, int32_t result) {
+    if (result != (int32_t)(buffer_ids.size() * PAGE_TABLE_SIZE)) {
+        debug_error("asynchronous I/O failed at finishBufferIo.\n");
+    }
+    for (auto&& buffer_id : buffer_ids) {
+        if (verifyPageChecksum(&buffer_pool[buffer_id],
+                               buffer_descriptor[buffer_id].tag.heap_file_block_id,
+                               buffer_descriptor[buffer_id].stats)) {
+            terminateBufferIo(buffer_id, 0);
+        } else {
+            initPage(&buffer_pool[buffer_id]);
+            terminateBufferIo(buffer_id, BM_DIRTY);
         }
     }
-    assert(victim_buffer_descriptor.read_id() > -1);
+}
 
-    // if victim descriptor is dirty, need to page flush.
-    if (buffer_descriptor[victim_buffer_descriptor.read_id()].flags == PageFlags::DIRTY) {
-        pageFlush(victim_buffer_descriptor.read_id());
+void BufferManager::terminateBufferIo(uint32_t buffer_id, uint32_t set_flags) {
+    // called under buffer_io_lock, so that waitBufferIo does not miss the notification.
+    BufferDescriptor& descriptor = buffer_descriptor[buffer_id];
+    uint32_t state               = lockBufferHeader(descriptor);
+    state                        = (state & ~BM_IO_IN_PROGRESS) | BM_VALID | set_flags;
+    descriptor.io_ticket         = 0;
+    unlockBufferHeader(descriptor, state);
+    buffer_io_cv.notify_all();
+}
+
+void BufferManager::pinBuffer(BufferId buffer_id, BufferAccessStrategy* strategy) {
+    // a page hit by a ring scan does not become hotter than a page read only once.
+    BufferDescriptor& descriptor = buffer_descriptor[buffer_id.id];
+    uint32_t old_state           = descriptor.state.load();
+    for (;;) {
+        if (old_state & BM_LOCKED) {
+            old_state = waitBufferHeaderUnlocked(descriptor);
+        }
+        uint32_t new_state = old_state + BUF_REFCOUNT_ONE;
+        if (strategy == nullptr ? bufUsageCount(old_state) < BM_MAX_USAGE_COUNT
+                                : bufUsageCount(old_state) == 0) {
+            new_state += BUF_USAGECOUNT_ONE;
+        }
+        if (descriptor.state.compare_exchange_weak(old_state, new_state)) {
+            return;
+        }
     }
+}
 
-    // delete victim page information
-    if (buffer_descriptor[victim_buffer_descriptor.read_id()].flags == PageFlags::VALID) {
-        data_entry_hash.erase(buffer_descriptor[victim_buffer_descriptor.read_id()].tag);
-        buffer_pool[victim_buffer_descriptor.read_id()]       = {0};
-        buffer_descriptor[victim_buffer_descriptor.read_id()] = {0};
+void BufferManager::unpinBuffer(BufferId buffer_id) {
+    BufferDescriptor& descriptor = buffer_descriptor[buffer_id.id];
+    uint32_t old_state           = descriptor.state.load();
+    for (;;) {
+        if (old_state & BM_LOCKED) {
+            old_state = waitBufferHeaderUnlocked(descriptor);
+        }
+        if (bufRefCount(old_state) == 0) {
+            debug_error("unpin not pinned buffer at unpinBuffer.\n");
+        }
+        if (descriptor.state.compare_exchange_weak(old_state, old_state - BUF_REFCOUNT_ONE)) {
+            return;
+        }
     }
+}
 
-    BufferId buffer_id                     = BufferId{victim_buffer_descriptor.read_id()};
-    BufferDescriptor new_buffer_descriptor = BufferDescriptor{
-        buffer_tag, PageFlags::VALID, 1, 1, victim_buffer_descriptor.read_id(),
-    };
-    memcpy(&buffer_descriptor[victim_buffer_descriptor.read_id()], &new_buffer_descriptor,
-           sizeof(BufferDescriptor));
+void BufferManager::markBufferDirty(BufferId buffer_id) {
+    BufferDescriptor& descriptor = buffer_descriptor[buffer_id.id];
+    uint32_t state               = lockBufferHeader(descriptor);
+    unlockBufferHeader(descriptor, state | BM_DIRTY);
+}
+
+bool BufferManager::pinDirtyBufferForWrite(BufferId buffer_id, uint32_t dirty_flag, bool wait) {
+    // pin a buffer with dirty_flag and take its content lock shared, so that it is neither
+    // evicted nor modified while being written. a buffer being modified right now is left for
+    // later, unless wait.
+    BufferDescriptor& descriptor = buffer_descriptor[buffer_id.id];
+    uint32_t state               = lockBufferHeader(descriptor);
+    if (!(state & dirty_flag)) {
+        unlockBufferHeader(descriptor, state);
+        return false;
+    }
+    unlockBufferHeader(descriptor, state + BUF_REFCOUNT_ONE);
+    if (wait) {
+        descriptor.content_lock.lock_shared();
+    } else if (!descriptor.content_lock.try_lock_shared()) {
+        unpinBuffer(buffer_id);
+        return false;
+    }
+    return true;
+}
+
+BufferId BufferManager::getDataEntry(BufferTag& buffer_tag, BufferAccessStrategy* strategy,
+                                    bool zero_page) {
+    uint64_t hash = BufferTag::Hash()(buffer_tag);
+    {
+        std::shared_lock<std::shared_mutex> partition_guard(buffer_table->getPartitionLock(hash));
+        int64_t target_buffer_id = buffer_table->lookup(buffer_tag, hash);
+        if (target_buffer_id >= 0) {
+            // pin under the partition lock, so that the buffer is not evicted in between.
+            BufferId buffer_id = BufferId{(uint64_t)target_buffer_id};
+            pinBuffer(buffer_id, strategy);
+            countStat(buffer_descriptor[buffer_id.id].stats->hits);
+            return buffer_id;
+        }
+    }
 
-    setPageToBufferPool(buffer_tag, &buffer_id);
+    // insert Tag and buffer id to buffer table, and read the page unless another thread
+    // has loaded it in the meantime
+    bool found;
+    BufferId buffer_id = setNewBufferDescriptor(buffer_tag, hash, strategy, &found);
+    if (!found) {
+        countStat(buffer_descriptor[buffer_id.id].stats->misses);
+        setPageToBufferPool(buffer_tag, &buffer_id, false, zero_page);
+    } else {
+        countStat(buffer_descriptor[buffer_id.id].stats->hits);
+    }
 
     return buffer_id;
 }
 
+BufferId BufferManager::setNewBufferDescriptor(BufferTag& buffer_tag, uint64_t hash,
+                                               BufferAccessStrategy* strategy, bool* found) {
+    BufferStats* stats = getRelationStats(buffer_tag.fd);
+    for (;;) {
+        // find victim page, which comes pinned
+        BufferId victim_buffer_id = getVictimBuffer(strategy);
+        BufferDescriptor& victim  = buffer_descriptor[victim_buffer_id.id];
+
+        // if victim descriptor is dirty, need to page flush.
+        if (victim.state.load() & BM_DIRTY) {
+            std::shared_lock<std::shared_mutex> content_guard(victim.content_lock);
+            pageFlush(victim_buffer_id.id);
+        }
+
+        // lock the partitions of the old and the new tag, always in the same order.
+        bool old_tag_valid = victim.state.load() & BM_TAG_VALID;
+        uint64_t old_hash  = old_tag_valid ? BufferTag::Hash()(victim.tag) : hash;
+        std::shared_mutex* first_lock  = &buffer_table->getPartitionLock(hash);
+        std::shared_mutex* second_lock = &buffer_table->getPartitionLock(old_hash);
+        if (first_lock > second_lock) std::swap(first_lock, second_lock);
+        std::unique_lock<std::shared_mutex> first_guard(*first_lock);
+        std::unique_lock<std::shared_mutex> second_guard;
+        if (second_lock != first_lock) {
+            second_guard = std::unique_lock<std::shared_mutex>(*second_lock);
+        }
+
+        // another thread has loaded the page while we were looking for a victim
+        int64_t existing_buffer_id = buffer_table->lookup(buffer_tag, hash);
+        if (existing_buffer_id >= 0) {
+            pinBuffer(BufferId{(uint64_t)existing_buffer_id}, strategy);
+            first_guard.unlock();
+            if (second_guard.owns_lock()) second_guard.unlock();
+            unpinBuffer(victim_buffer_id);
+            *found = true;
+            return BufferId{(uint64_t)existing_buffer_id};
+        }
+
+        // someone pinned or dirtied the victim while it was flushed, look for another one.
+        uint32_t state = lockBufferHeader(victim);
+        if (bufRefCount(state) != 1 || (state & BM_DIRTY)) {
+            unlockBufferHeader(victim, state);
+            first_guard.unlock();
+            if (second_guard.owns_lock()) second_guard.unlock();
+            unpinBuffer(victim_buffer_id);
+            continue;
+        }
+
+        // delete victim page information, and keep the descriptor BM_IO_IN_PROGRESS while
+        // loading, so that other threads wait for the page.
+        if (old_tag_valid) {
+            buffer_table->erase(victim.tag, old_hash);
+            countStat(victim.stats->evictions);
+        }
+        victim.tag   = buffer_tag;
+        victim.stats = stats;
+        buffer_table->insert(buffer_tag, hash, victim_buffer_id);
+        state = (state & (BUF_REFCOUNT_MASK | BM_LOCKED)) | BUF_USAGECOUNT_ONE | BM_TAG_VALID |
+                BM_IO_IN_PROGRESS;
+        unlockBufferHeader(victim, state);
+        *found = false;
+        return victim_buffer_id;
+    }
+}
+
+uint32_t BufferManager::clockSweepTick() {
+    return (uint32_t)(next_victim_buffer.fetch_add(1) % page_nums);
+}
+
+int64_t BufferManager::getBufferFromRing(BufferAccessStrategy* strategy) {
+    // reuse the next ring buffer only if nobody else is using it. a pinned buffer or one with a
+    // higher usage_count has been touched by another scan or query, so leave it to the pool.
+    strategy->current = (strategy->current + 1) % strategy->ring.size();
+    int64_t buffer_id = strategy->ring[strategy->current];
+    if (buffer_id < 0) {
+        return -1;
+    }
+    BufferDescriptor& candidate = buffer_descriptor[buffer_id];
+    if ((candidate.state.load() & BM_IO_IN_PROGRESS) && !tryCompleteBufferIo(buffer_id)) {
+        return -1;
+    }
+    uint32_t state = lockBufferHeader(candidate);
+    if (bufRefCount(state) == 0 && !(state & BM_IO_IN_PROGRESS) && bufUsageCount(state) <= 1) {
+        unlockBufferHeader(candidate, state + BUF_REFCOUNT_ONE);
+        return buffer_id;
+    }
+    unlockBufferHeader(candidate, state);
+    return -1;
+}
+
+BufferId BufferManager::getVictimBuffer(BufferAccessStrategy* strategy) {
+    // the victim is returned pinned.
+    if (strategy != nullptr) {
+        int64_t ring_buffer_id = getBufferFromRing(strategy);
+        if (ring_buffer_id >= 0) {
+            return BufferId{(uint64_t)ring_buffer_id};
+        }
+    }
+
+    // clock sweep: every pass of the hand decrements usage_count, and the first unpinned buffer
+    // whose usage_count has already reached 0 is the victim. try_count is reset whenever some
+    // buffer is decremented. other threads pin buffers only for a while, so after a full lap
+    // over pinned buffers we wait a little, and only give up after MAX_VICTIM_LAPS laps.
+    uint32_t try_count = page_nums;
+    uint32_t lap_count = 0;
+    for (;;) {
+        uint32_t buffer_id          = clockSweepTick();
+        BufferDescriptor& candidate = buffer_descriptor[buffer_id];
+        uint32_t state              = candidate.state.load();
+        if (bufRefCount(state) == 0 && (state & BM_IO_IN_PROGRESS)) {
+            // an unpinned buffer in I/O is a prefetched page, usable once the read is done.
+            tryCompleteBufferIo(buffer_id);
+        }
+        state = lockBufferHeader(candidate);
+        if (bufRefCount(state) == 0 && !(state & BM_IO_IN_PROGRESS)) {
+            if (bufUsageCount(state) == 0) {
+                unlockBufferHeader(candidate, state + BUF_REFCOUNT_ONE);
+                ++recent_alloc_count;
+                if (strategy != nullptr) {
+                    strategy->ring[strategy->current] = buffer_id;
+                }
+                return BufferId{buffer_id};
+            }
+            unlockBufferHeader(candidate, state - BUF_USAGECOUNT_ONE);
+            try_count = page_nums;
+            continue;
+        }
+        unlockBufferHeader(candidate, state);
+        if (--try_count == 0) {
+            if (++lap_count >= MAX_VICTIM_LAPS) {
+                debug_error("no unpinned buffers available at getVictimBuffer.\n");
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            try_count = page_nums;
+        }
+    }
+}
+
+void BufferManager::backgroundWriterMain() {
+    std::unique_lock<std::mutex> lock(bgwriter_mutex);
+    while (!bgwriter_shutdown) {
+        bgwriter_cv.wait_for(lock, std::chrono::milliseconds(BGWRITER_DELAY_MS),
+                             [this] { return bgwriter_shutdown; });
+        if (bgwriter_shutdown) break;
+        lock.unlock();
+        backgroundBufferSync();
+        lock.lock();
+    }
+}
+
+uint32_t BufferManager::backgroundBufferSync() {
+    // background writer: clean the buffers just ahead of the clock hand, so that foreground
+    // victims are already clean. The number of buffers to clean in this round is the smoothed
+    // number of recent allocations times BGWRITER_LRU_MULTIPLIER, at most BGWRITER_LRU_MAXPAGES.
+    uint64_t clock_hand         = next_victim_buffer.load();
+    uint32_t strategy_buffer_id = (uint32_t)(clock_hand % page_nums);
+    uint64_t strategy_passes    = clock_hand / page_nums;
+    uint32_t recent_alloc       = recent_alloc_count.exchange(0);
+
+    // how far is the background writer ahead of the clock hand. if it has been lapped,
+    // restart from the clock hand.
+    int64_t buffers_ahead =
+        ((int64_t)bgwriter_next_passes - (int64_t)strategy_passes) * page_nums +
+        (int64_t)bgwriter_next_to_clean - (int64_t)strategy_buffer_id;
+    if (buffers_ahead < 0) {
+        bgwriter_next_to_clean = strategy_buffer_id;
+        bgwriter_next_passes   = strategy_passes;
+        buffers_ahead          = 0;
+    }
+
+    // follow rises in demand immediately, decay slowly.
+    if ((float)recent_alloc >= bgwriter_smoothed_alloc) {
+        bgwriter_smoothed_alloc = (float)recent_alloc;
+    } else {
+        bgwriter_smoothed_alloc += ((float)recent_alloc - bgwriter_smoothed_alloc) / 16;
+    }
+    int64_t upcoming_alloc = (int64_t)(bgwriter_smoothed_alloc * BGWRITER_LRU_MULTIPLIER);
+
+    // buffers between the clock hand and bgwriter_next_to_clean were already cleaned.
+    int64_t reusable_buffers = buffers_ahead;
+    std::vector<uint32_t> dirty_buffer_ids;
+    while (reusable_buffers < upcoming_alloc && buffers_ahead < page_nums &&
+           dirty_buffer_ids.size() < BGWRITER_LRU_MAXPAGES) {
+        uint32_t state = buffer_descriptor[bgwriter_next_to_clean].state.load();
+        if (bufRefCount(state) == 0 && bufUsageCount(state) == 0) {
+            if ((state & BM_DIRTY) && pinDirtyBufferForWrite(BufferId{bgwriter_next_to_clean})) {
+                dirty_buffer_ids.push_back(bgwriter_next_to_clean);
+            }
+            ++reusable_buffers;
+        }
+        if (++bgwriter_next_to_clean >= page_nums) {
+            bgwriter_next_to_clean = 0;
+            ++bgwriter_next_passes;
+        }
+        ++buffers_ahead;
+    }
+
+    // write them all at once, so that neighbouring blocks are combined into one write, and
+    // keep every write in flight before waiting for any of them.
+    uint32_t written_num = flushBuffers(dirty_buffer_ids, FlushReason::BGWRITER, true);
+    releaseWrittenBuffers(dirty_buffer_ids);
+    return written_num;
+}
+
+void BufferManager::checkpointerMain() {
+    // start a checkpoint every CHECKPOINT_TIMEOUT_S seconds, or earlier when the WAL since the
+    // redo point has grown to CHECKPOINT_WAL_SIZE_MB. nothing is done while the WAL is idle.
+    auto last_checkpoint_time = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(checkpointer_mutex);
+    while (!checkpointer_shutdown) {
+        checkpointer_cv.wait_for(lock, std::chrono::milliseconds(CHECKPOINT_POLL_MS),
+                                 [this] { return checkpointer_shutdown; });
+        if (checkpointer_shutdown) break;
+        if (!recovery_done) continue;
+        auto now          = std::chrono::steady_clock::now();
+        bool timed_out =
+            now - last_checkpoint_time >= std::chrono::seconds(CHECKPOINT_TIMEOUT_S);
+        uint64_t wal_size = wal_manager->getInsertLsn() - wal_manager->getRedoLsn();
+        if ((timed_out && wal_size > 0) || wal_size >= (uint64_t)CHECKPOINT_WAL_SIZE_MB << 20) {
+            lock.unlock();
+            createCheckpoint(false);
+            lock.lock();
+            last_checkpoint_time = std::chrono::steady_clock::now();
+        } else if (timed_out) {
+            last_checkpoint_time = now;
+        }
+    }
+}
+
+void BufferManager::createCheckpoint(bool immediate) {
+    // fuzzy checkpoint: the buffers which are dirty at the redo point are written while the
+    // other threads keep going, spread over CHECKPOINT_COMPLETION_TARGET of the interval
+    // between checkpoints unless immediate. then the WAL before the redo point is not needed.
+    std::lock_guard<std::mutex> checkpoint_guard(checkpoint_lock);
+    auto start_time   = std::chrono::steady_clock::now();
+    uint64_t redo_lsn;
+    {
+        // not between the records of a columnar row, see insertColumnarTuple.
+        std::unique_lock<std::shared_mutex> delay_guard(checkpoint_delay_lock);
+        redo_lsn = wal_manager->startCheckpoint();
+    }
+
+    // a page is marked dirty before its change is logged, so every page changed before the
+    // redo point is dirty or already written by now.
+    std::vector<std::tuple<int, uint64_t, uint32_t>> checkpoint_buffers;  // fd, block, buffer id
+    for (uint32_t i = 0; i < page_nums; i++) {
+        BufferDescriptor& descriptor = buffer_descriptor[i];
+        uint32_t state               = lockBufferHeader(descriptor);
+        if (state & BM_DIRTY) {
+            checkpoint_buffers.push_back(
+                {descriptor.tag.fd, descriptor.tag.heap_file_block_id, i});
+            state |= BM_CHECKPOINT_NEEDED;
+        }
+        unlockBufferHeader(descriptor, state);
+    }
+    // write in file order, so that neighbouring blocks are combined into one write.
+    std::sort(checkpoint_buffers.begin(), checkpoint_buffers.end());
+
+    // keep most of the pool unpinned while a batch is written.
+    uint32_t batch_size = std::max(1u, std::min(MAX_WRITE_COMBINE_PAGES, page_nums / 4));
+    std::vector<uint32_t> dirty_buffer_ids;
+    for (size_t batch_start = 0; batch_start < checkpoint_buffers.size();
+         batch_start += batch_size) {
+        size_t batch_end = std::min(checkpoint_buffers.size(), batch_start + batch_size);
+        dirty_buffer_ids.clear();
+        for (size_t i = batch_start; i < batch_end; i++) {
+            // a buffer written by someone else in the meantime is skipped. before waiting for a
+            // buffer being modified, write the batch so far, so that no content lock is held
+            // while waiting for another one.
+            uint32_t buffer_id = std::get<2>(checkpoint_buffers[i]);
+            if (pinDirtyBufferForWrite(BufferId{buffer_id}, BM_CHECKPOINT_NEEDED)) {
+                dirty_buffer_ids.push_back(buffer_id);
+                continue;
+            }
+            if (!(buffer_descriptor[buffer_id].state.load() & BM_CHECKPOINT_NEEDED)) {
+                continue;
+            }
+            flushBuffers(dirty_buffer_ids, FlushReason::CHECKPOINT);
+            releaseWrittenBuffers(dirty_buffer_ids);
+            dirty_buffer_ids.clear();
+            if (pinDirtyBufferForWrite(BufferId{buffer_id}, BM_CHECKPOINT_NEEDED, true)) {
+                dirty_buffer_ids.push_back(buffer_id);
+            }
+        }
+        flushBuffers(dirty_buffer_ids, FlushReason::CHECKPOINT);
+        releaseWrittenBuffers(dirty_buffer_ids);
+
+        // sleep while ahead of schedule. the progress is compared with both the elapsed time
+        // and the WAL written since the redo point, whichever starts the next checkpoint first.
+        while (!immediate) {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+            double progress  = (double)batch_end / checkpoint_buffers.size();
+            double time_used = elapsed.count() / CHECKPOINT_TIMEOUT_S;
+            double wal_used  = (double)(wal_manager->getInsertLsn() - redo_lsn) /
+                              ((uint64_t)CHECKPOINT_WAL_SIZE_MB << 20);
+            if (progress <= std::max(time_used, wal_used) / CHECKPOINT_COMPLETION_TARGET) break;
+            std::unique_lock<std::mutex> lock(checkpointer_mutex);
+            // at shutdown, finish the rest at once.
+            if (checkpointer_cv.wait_for(lock, std::chrono::milliseconds(CHECKPOINT_POLL_MS),
+                                         [this] { return checkpointer_shutdown; })) {
+                immediate = true;
+            }
+        }
+    }
+
+    // wait for the writes of other threads which had already cleared BM_DIRTY, then make
+    // every page and the schema durable.
+    { std::unique_lock<std::shared_mutex> flush_guard(flush_lock); }
+    disk_manager->syncRelations();
+    {
+        // the tables created before the redo point are in the schema file.
+        std::shared_lock<std::shared_mutex> catalog_guard(catalog_lock);
+        int schema_fd = open((PROJECT_PATH + SCHEMA_FILE_NAME).c_str(), O_RDONLY);
+        if (schema_fd != -1) {
+            fsync(schema_fd);
+            close(schema_fd);
+        }
+    }
+
+    wal_manager->finishCheckpoint(redo_lsn);
+}
+
 std::pair<Oid, Oid> BufferManager::getTableOid(const char* table_name) {
-    if (buffer_table_info.contains(table_name)) {
-        TableInfoHeader* table_info_header = buffer_table_info[table_name];
+    std::shared_lock<std::shared_mutex> catalog_guard(catalog_lock);
+    auto target = buffer_table_info.find(table_name);
+    if (target != buffer_table_info.end()) {
+        TableInfoHeader* table_info_header = target->second;
         return std::make_pair(table_info_header->db_node, table_info_header->rel_node);
     }
 
@@ -166,63 +1270,170 @@ std::pair<Oid, Oid> BufferManager::getTableOid(const char* table_name) {
     return std::make_pair(__LONG_LONG_MAX__, __LONG_LONG_MAX__);
 }
 
-void BufferManager::setPageToBufferPool(BufferTag& buffer_tag, BufferId* buffer_id) {
-    auto table_size = getTablePageSize(buffer_tag.table_ident);
+void BufferManager::setPageToBufferPool(BufferTag& buffer_tag, BufferId* buffer_id,
+                                        bool async_read, bool zero_page) {
+    // the buffer is pinned and BM_IO_IN_PROGRESS, and only this thread touches the page.
+    RelationFile* relation_file = disk_manager->getRelation(buffer_tag.fd);
     // need new page
-    if (table_size < (buffer_tag.heap_file_block_id + 1) * PAGE_TABLE_SIZE) {
-        // set default HeapHeaderInfo
-        buffer_pool[buffer_id->id].heap_header_info.pd_lsn      = 0;
-        buffer_pool[buffer_id->id].heap_header_info.pd_checksum = 0;
-        buffer_pool[buffer_id->id].heap_header_info.pd_lower    = sizeof(HeapHeaderInfo);
-        buffer_pool[buffer_id->id].heap_header_info.pd_upper    = PAGE_TABLE_SIZE;
-        buffer_pool[buffer_id->id].heap_header_info.pd_special  = 0;
-        buffer_descriptor[buffer_id->id].flags                  = PageFlags::DIRTY;
-        return;
+    if (zero_page || relation_file->disk_block_num <= buffer_tag.heap_file_block_id) {
+        initPage(&buffer_pool[buffer_id->id]);
+        relation_file->extendTo(buffer_tag.heap_file_block_id + 1);
+        std::lock_guard<std::mutex> guard(buffer_io_lock);
+        terminateBufferIo(buffer_id->id, BM_DIRTY);
+    } else if (async_read) {
+        std::lock_guard<std::mutex> guard(buffer_io_lock);
+        uint64_t io_ticket = disk_manager->startReadPage(
+            buffer_tag.fd, buffer_tag.heap_file_block_id, &buffer_pool[buffer_id->id]);
+        countStat(buffer_descriptor[buffer_id->id].stats->read_bytes, PAGE_TABLE_SIZE);
+        buffer_descriptor[buffer_id->id].io_ticket = io_ticket;
+        inflight_buffer_io[io_ticket]              = {(uint32_t)buffer_id->id};
+        // wake up the threads which found the buffer before its read was registered
+        buffer_io_cv.notify_all();
     } else {
-        std::ifstream ifs((PROJECT_PATH + buffer_tag.table_ident),
-                          std::ios::binary | std::ios::in | std::ios::out);
-        if (!ifs.good()) {
-            debug_error("Failed to open the file at setPageToBufferPool.\n");
-        }
-        ifs.seekg(buffer_tag.heap_file_block_id * PAGE_TABLE_SIZE, std::ios::beg);
-        ifs.read(reinterpret_cast<char*>(&buffer_pool[buffer_id->id]), PAGE_TABLE_SIZE);
-        if (ifs.fail()) {
-            debug_error("Failed to read the file at setPageToBufferPool.\n");
+        disk_manager->readPage(buffer_tag.fd, buffer_tag.heap_file_block_id,
+                               &buffer_pool[buffer_id->id]);
+        countStat(buffer_descriptor[buffer_id->id].stats->read_bytes, PAGE_TABLE_SIZE);
+        uint32_t set_flags = 0;
+        if (!verifyPageChecksum(&buffer_pool[buffer_id->id], buffer_tag.heap_file_block_id,
+                                buffer_descriptor[buffer_id->id].stats)) {
+            initPage(&buffer_pool[buffer_id->id]);
+            set_flags = BM_DIRTY;
         }
+        std::lock_guard<std::mutex> guard(buffer_io_lock);
+        terminateBufferIo(buffer_id->id, set_flags);
     }
 }
 
-void BufferManager::pageFlush(uint16_t buffer_id) {
-    if (buffer_descriptor[buffer_id].flags != PageFlags::DIRTY) {
-        printf("Try to flush non dirty page.\n");
-        exit(EXIT_FAILURE);
+void BufferManager::pageFlush(uint32_t buffer_id) {
+    // the caller has pinned the buffer and holds its content lock.
+    if (!(buffer_descriptor[buffer_id].state.load() & BM_DIRTY)) {
+        return;
     }
 
+    // write the dirty neighbour blocks of the same table together with the target page.
     BufferTag target_tag = buffer_descriptor[buffer_id].tag;
-
-    std::string table_name = std::string(target_tag.table_ident);
-    std::ofstream ofs((PROJECT_PATH + table_name).c_str(),
-                      std::ios::binary | std::ios::out | std::ios::in);
-
-    if (!ofs.good()) {
-        debug_error("failed to open file at pageFlush.\n");
+    std::vector<uint32_t> neighbour_buffer_ids;
+    for (int direction : {-1, 1}) {
+        BufferTag neighbour_tag = target_tag;
+        for (uint32_t i = 1; i < MAX_WRITE_COMBINE_PAGES; i++) {
+            if (direction < 0 && neighbour_tag.heap_file_block_id == 0) break;
+            neighbour_tag.heap_file_block_id += direction;
+            uint64_t hash = BufferTag::Hash()(neighbour_tag);
+            std::shared_lock<std::shared_mutex> partition_guard(
+                buffer_table->getPartitionLock(hash));
+            int64_t neighbour_id = buffer_table->lookup(neighbour_tag, hash);
+            if (neighbour_id < 0 || !pinDirtyBufferForWrite(BufferId{(uint64_t)neighbour_id})) {
+                break;
+            }
+            neighbour_buffer_ids.push_back((uint32_t)neighbour_id);
+        }
     }
 
-    ofs.seekp(target_tag.heap_file_block_id * PAGE_TABLE_SIZE, std::ios::beg);
-    ofs.write(reinterpret_cast<const char*>(&buffer_pool[buffer_id]), PAGE_TABLE_SIZE);
+    std::vector<uint32_t> dirty_buffer_ids = neighbour_buffer_ids;
+    dirty_buffer_ids.push_back(buffer_id);
+    flushBuffers(dirty_buffer_ids, FlushReason::EVICTION);
+    releaseWrittenBuffers(neighbour_buffer_ids);
+}
 
-    if (ofs.fail()) {
-        debug_error("seeking error at pageFlush.\n");
+uint32_t BufferManager::flushBuffers(const std::vector<uint32_t>& buffer_ids, FlushReason reason,
+                                     bool async_write) {
+    // every buffer is pinned and its content lock is held shared by the caller, so no one
+    // modifies the pages while they are written, and BM_DIRTY is cleared before the write.
+    // the checksum is set in a private copy of each page, and the copy is written, since the
+    // other holders of the shared lock may be reading the page in the pool.
+    // sort by (file, block) and issue one vectored write for each run of contiguous blocks.
+    // with async_write, every write is submitted before waiting for any of them.
+    // flush_lock is held until the writes are done, so that a checkpoint can wait for the pages
+    // which are not dirty anymore but not yet written.
+    std::shared_lock<std::shared_mutex> flush_guard(flush_lock);
+    std::vector<uint32_t> write_buffer_ids;
+    for (auto&& buffer_id : buffer_ids) {
+        BufferDescriptor& descriptor = buffer_descriptor[buffer_id];
+        uint32_t state               = lockBufferHeader(descriptor);
+        unlockBufferHeader(descriptor, state & ~(BM_DIRTY | BM_CHECKPOINT_NEEDED));
+        if (!(state & BM_DIRTY)) {
+            continue;
+        }
+        write_buffer_ids.push_back(buffer_id);
+        countStat(descriptor.stats->write_bytes, PAGE_TABLE_SIZE);
+        if (reason == FlushReason::EVICTION) {
+            countStat(descriptor.stats->eviction_writes);
+        } else if (reason == FlushReason::BGWRITER) {
+            countStat(descriptor.stats->bgwriter_writes);
+        } else if (reason == FlushReason::CHECKPOINT) {
+            countStat(descriptor.stats->checkpoint_writes);
+        }
+    }
+    // WAL before data: the WAL must be durable up to the last change of every page.
+    uint64_t max_page_lsn = 0;
+    for (auto&& buffer_id : write_buffer_ids) {
+        max_page_lsn = std::max(max_page_lsn, buffer_pool[buffer_id].heap_header_info.pd_lsn);
+    }
+    wal_manager->flush(max_page_lsn);
+    std::sort(write_buffer_ids.begin(), write_buffer_ids.end(), [this](uint32_t lhs, uint32_t rhs) {
+        const BufferTag& lhs_tag = buffer_descriptor[lhs].tag;
+        const BufferTag& rhs_tag = buffer_descriptor[rhs].tag;
+        return std::tie(lhs_tag.fd, lhs_tag.heap_file_block_id) <
+               std::tie(rhs_tag.fd, rhs_tag.heap_file_block_id);
+    });
+    // the copies are aligned to the OS page size like the pool, for O_DIRECT.
+    size_t os_page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t copies_size  = std::max(write_buffer_ids.size() * PAGE_TABLE_SIZE, os_page_size);
+    std::unique_ptr<BufferPage, decltype(&free)> page_copies(
+        (BufferPage*)aligned_alloc(os_page_size,
+                                   (copies_size + os_page_size - 1) / os_page_size * os_page_size),
+        free);
+    if (page_copies == nullptr) {
+        debug_error("failed to allocate page copies at flushBuffers.\n");
+    }
+    for (size_t i = 0; i < write_buffer_ids.size(); i++) {
+        BufferPage* page_copy = page_copies.get() + i;
+        memcpy(page_copy, &buffer_pool[write_buffer_ids[i]], PAGE_TABLE_SIZE);
+        page_copy->heap_header_info.pd_checksum =
+            pageChecksum(page_copy, buffer_descriptor[write_buffer_ids[i]].tag.heap_file_block_id);
     }
 
-    ofs.close();
+    std::vector<const void*> run_pages;
+    // ticket, file, first block and number of pages of every asynchronous write
+    std::vector<std::tuple<uint64_t, int, uint64_t, size_t>> io_tickets;
+    for (size_t run_start = 0; run_start < write_buffer_ids.size();) {
+        const BufferTag& start_tag = buffer_descriptor[write_buffer_ids[run_start]].tag;
+        size_t run_end             = run_start;
+        run_pages.clear();
+        for (; run_end < write_buffer_ids.size(); ++run_end) {
+            const BufferTag& tag = buffer_descriptor[write_buffer_ids[run_end]].tag;
+            if (tag.fd != start_tag.fd ||
+                tag.heap_file_block_id != start_tag.heap_file_block_id + (run_end - run_start)) {
+                break;
+            }
+            run_pages.push_back(page_copies.get() + run_end);
+        }
+        if (async_write) {
+            uint64_t io_ticket = disk_manager->startWritePages(
+                start_tag.fd, start_tag.heap_file_block_id, run_pages);
+            io_tickets.push_back(
+                {io_ticket, start_tag.fd, start_tag.heap_file_block_id, run_pages.size()});
+        } else {
+            disk_manager->writePages(start_tag.fd, start_tag.heap_file_block_id, run_pages);
+        }
+        run_start = run_end;
+    }
+    for (auto&& [io_ticket, fd, start_block_id, page_num] : io_tickets) {
+        disk_manager->waitWritePages(io_ticket, fd, start_block_id, page_num);
+    }
 
-    buffer_descriptor[buffer_id].flags = PageFlags::VALID;
+    return (uint32_t)write_buffer_ids.size();
+}
 
-    // std::cout << "pageFlush buffer id: " << buffer_id << std::endl;
+void BufferManager::releaseWrittenBuffers(const std::vector<uint32_t>& buffer_ids) {
+    for (auto&& buffer_id : buffer_ids) {
+        buffer_descriptor[buffer_id].content_lock.unlock_shared();
+        unpinBuffer(BufferId{buffer_id});
+    }
 }
 
 void BufferManager::tablePageFlush() {
+    // called with catalog_lock held exclusively
     assert(table_info_flags == PageFlags::DIRTY);
     std::ofstream ofs(PROJECT_PATH + std::string(SCHEMA_FILE_NAME),
                       std::ios::binary | std::ios::out | std::ios::in);
@@ -242,199 +1453,602 @@ void BufferManager::tablePageFlush() {
     table_info_flags = PageFlags::VALID;
 }
 
-uint64_t BufferManager::getTablePageNum(const char* table_name) {
-    uint64_t page_num       = 0;
-    std::string table_ident = std::string(table_name);
-    FILE* fp                = fopen((PROJECT_PATH + table_ident).c_str(), "rb");
-
-    if (fp == NULL) {
-        std::cout << table_name << std::endl;
-        debug_error("cannot open table file at getTablePageNum.\n");
-    }
+uint64_t BufferManager::getTablePageNum(const ProjectionPlan& plan) {
+    // a columnar table has no heap file, and its pages are the blocks of the segment of the
+    // first selected column.
+    int fd = plan.tuple_layout == TupleLayout::COLUMNAR ? plan.segment_fds[0] : plan.fd;
+    return disk_manager->getRelation(fd)->block_num;
+}
 
-    if (fseek(fp, 0L, SEEK_END) == 0) {
-        fpos_t pos;
+void PageTupleViews::release() { page_guard.release(); }
 
-        if (fgetpos(fp, &pos) == 0) {
-            fclose(fp);
-            page_num = (uint64_t)(std::max((long)pos.__pos, (long)0) / PAGE_TABLE_SIZE);
-            // std::cout << "page_nummmmmmmmmmmmmmmmmmmmmmmmm: " << page_num << std::endl;
+std::unique_ptr<ProjectionPlan> BufferManager::createProjectionPlan(const char* table_name,
+                                                                   IdentList* column_ident_list) {
+    std::unique_ptr<ProjectionPlan> plan = std::make_unique<ProjectionPlan>();
+    auto table_oid                       = getTableOid(table_name);
+    plan->table_name                     = table_name;
+    plan->db_node                        = table_oid.first;
+    plan->rel_node                       = table_oid.second;
+    {
+        std::shared_lock<std::shared_mutex> catalog_guard(catalog_lock);
+        plan->tuple_layout      = buffer_table_info.at(table_name)->tuple_layout;
+        plan->column_tuple_list = column_list_map.at(plan->rel_node);
+    }
+    assert(plan->column_tuple_list.size() > 0);
+    plan->fd = plan->tuple_layout == TupleLayout::COLUMNAR
+                   ? -1
+                   : disk_manager->openRelation(table_name, false)->fd;
+    plan->tuple_size = plan->tuple_layout == TupleLayout::VARIABLE
+                           ? 0
+                           : fixedTupleSize(plan->column_tuple_list);
+
+    // the fields are returned in the column order of the table, each one once.
+    std::vector<bool> selected(plan->column_tuple_list.size(), false);
+    for (auto target_ident = column_ident_list; target_ident != NULL;
+         target_ident      = target_ident->next) {
+        if (!strcmp(target_ident->ident, "*")) {
+            selected.assign(selected.size(), true);
+            continue;
+        }
+        bool found = false;
+        for (uint32_t i = 0; i < plan->column_tuple_list.size(); i++) {
+            if (!strcmp(target_ident->ident, plan->column_tuple_list[i]->column_ident)) {
+                selected[i] = true;
+                found       = true;
+            }
+        }
+        if (!found) {
+            debug_error("unknown column " + std::string(target_ident->ident) +
+                        " at createProjectionPlan.\n");
         }
     }
-
-    for (const auto& [buffer_tag, _] : data_entry_hash) {
-        if (!strcmp(buffer_tag.table_ident, table_name)) {
-            if (page_num < (uint64_t)(buffer_tag.heap_file_block_id + 1))
-                // std::cout << "ggggggggggggtttttttttttt!@!!!\n";
-                page_num =
-                    (uint64_t)std::max(page_num, (uint64_t)(buffer_tag.heap_file_block_id + 1));
+    for (uint16_t i = 0; i < selected.size(); i++) {
+        if (selected[i]) {
+            plan->field_ids.push_back(i + 1);
+            plan->columns.push_back(plan->column_tuple_list[i].get());
+            if (plan->tuple_layout == TupleLayout::COLUMNAR) {
+                plan->segment_fds.push_back(
+                    disk_manager->openRelation(columnSegmentName(table_name, i).c_str(), true)
+                        ->fd);
+            }
         }
     }
-
-    // std::cout << "pppppppppppppppppppppppage_num: " << page_num << std::endl;
-    return page_num;
+    return plan;
 }
 
-uint64_t BufferManager::getTablePageSize(const char* table_name) {
-    uint64_t page_size      = __LONG_LONG_MAX__;
-    std::string table_ident = std::string(table_name);
-    FILE* fp                = fopen((PROJECT_PATH + table_ident).c_str(), "rb");
-
-    if (fp == NULL) {
-        std::cout << table_name << std::endl;
-        debug_error("cannot open table file at getTablePageNum.\n");
+void BufferManager::getPageTupleViews(const ProjectionPlan& plan, PageId page_id,
+                                      PageTupleViews* views, ReadAheadState* read_ahead,
+                                      BufferAccessStrategy* strategy) {
+    // the previous page is released first, so that a scan holds one page at a time.
+    views->release();
+    views->fields.clear();
+    views->tuple_ends.clear();
+
+    if (plan.tuple_layout == TupleLayout::COLUMNAR) {
+        // the rows of block page_id of the first selected segment, taken from every selected
+        // segment one block at a time. an insert appends to the segments from the last column to
+        // the first, so the other selected segments have at least the rows of the first one.
+        if (read_ahead != nullptr) {
+            views->segment_read_ahead.resize(plan.columns.size());
+        }
+        views->column_blocks.resize(plan.columns.size());
+        loadColumnBlock(plan, 0, page_id, views, read_ahead != nullptr, strategy);
+        uint64_t first_row = views->column_blocks[0].first_row;
+        uint32_t row_num   = views->column_blocks[0].row_num;
+        views->values.resize((size_t)row_num * plan.tuple_size);
+        uint8_t* column_area = views->values.data();
+        for (size_t i = 0; i < plan.columns.size(); i++) {
+            uint16_t type_size = plan.columns[i]->type_size;
+            for (uint64_t row = first_row; row < first_row + row_num;) {
+                const ColumnBlockCursor& block =
+                    seekColumnBlock(plan, i, row, views, read_ahead != nullptr, strategy);
+                uint64_t end_row = std::min(first_row + row_num, block.first_row + block.row_num);
+                memcpy(column_area + (row - first_row) * type_size,
+                       block.values.data() + (row - block.first_row) * type_size,
+                       (end_row - row) * type_size);
+                row = end_row;
+            }
+            column_area += (size_t)row_num * type_size;
+        }
+        for (uint32_t row = 0; row < row_num; row++) {
+            const uint8_t* area = views->values.data();
+            for (const ColumnTuple* column : plan.columns) {
+                views->fields.push_back(
+                    FieldView{column, area + (size_t)row * column->type_size, column->type_size});
+                area += (size_t)row_num * column->type_size;
+            }
+            views->tuple_ends.push_back((uint32_t)views->fields.size());
+        }
+        return;
     }
 
-    if (fseek(fp, 0L, SEEK_END) == 0) {
-        fpos_t pos;
+    BufferTag buffer_tag =
+        BufferTag{plan.db_node, plan.rel_node, plan.fd, page_id, plan.table_name};
 
-        if (fgetpos(fp, &pos) == 0) {
-            fclose(fp);
-            page_size = (uint64_t)pos.__pos;
+    if (read_ahead != nullptr) {
+        readAhead(buffer_tag, read_ahead, strategy);
+    }
+    // with mmap_reads, a page on disk is copied from the mapping instead of loaded into the pool.
+    const uint8_t* page_start_ptr = nullptr;
+    if (disk_manager->isMmapReads()) {
+        if (views->mapped_page == nullptr) {
+            views->mapped_page = std::make_unique<BufferPage>();
+        }
+        if (readMappedPage(buffer_tag, views->mapped_page.get())) {
+            page_start_ptr = (const uint8_t*)views->mapped_page.get();
         }
     }
-
-    for (const auto& [buffer_tag, _] : data_entry_hash) {
-        if (!strcmp(buffer_tag.table_ident, table_name)) {
-            page_size = (uint64_t)std::max(
-                page_size, (uint64_t)(PAGE_TABLE_SIZE * (buffer_tag.heap_file_block_id + 1)));
+    if (page_start_ptr == nullptr) {
+        views->page_guard = fetchPage(buffer_tag, strategy);
+        views->page_guard.lockShared();
+        page_start_ptr = (const uint8_t*)views->page_guard.getPage();
+    }
+    uint16_t pd_lower = ((const BufferPage*)page_start_ptr)->heap_header_info.pd_lower;
+
+    if (plan.tuple_layout == TupleLayout::PAX) {
+        // only the minipages of the selected columns are read.
+        uint16_t tuple_num      = (uint16_t)((pd_lower - sizeof(HeapHeaderInfo)) / plan.tuple_size);
+        uint16_t capacity       = (uint16_t)(HEAP_CONTENT_SIZE / plan.tuple_size);
+        const uint8_t* minipage = page_start_ptr + sizeof(HeapHeaderInfo);
+        for (uint16_t slot = 0; slot < tuple_num; slot++) {
+            for (const ColumnTuple* column : plan.columns) {
+                views->fields.push_back(FieldView{
+                    column, minipage + capacity * column->fixed_offset + slot * column->type_size,
+                    column->type_size});
+            }
+            views->tuple_ends.push_back((uint32_t)views->fields.size());
         }
+        return;
     }
 
-    // debug_error("getTablePageSize error.\n");
-
-    return page_size;
+    // operate every tuple
+    for (const uint16_t* line_pos_ptr = (const uint16_t*)(page_start_ptr + sizeof(HeapHeaderInfo));
+         (const uint8_t*)line_pos_ptr - page_start_ptr != pd_lower; ++line_pos_ptr) {
+        const uint8_t* tuple_ptr = page_start_ptr + *line_pos_ptr;
+        if (plan.tuple_layout == TupleLayout::FIXED) {
+            // the fields are at the offsets from the schema
+            for (const ColumnTuple* column : plan.columns) {
+                views->fields.push_back(
+                    FieldView{column, tuple_ptr + column->fixed_offset, column->type_size});
+            }
+        } else {
+            const uint8_t* tuple_end_ptr =
+                (const uint16_t*)(page_start_ptr + sizeof(HeapHeaderInfo)) < line_pos_ptr
+                    ? page_start_ptr + *(line_pos_ptr - 1)
+                    : page_start_ptr + PAGE_TABLE_SIZE;
+            uint16_t field_data_num = *(const uint16_t*)(tuple_ptr);
+            // collect only the selected fields
+            for (size_t i = 0; i < plan.field_ids.size(); i++) {
+                uint16_t field_id = plan.field_ids[i];
+                if (field_id > field_data_num) {
+                    break;
+                }
+                uint16_t field_start_pos = *((const uint16_t*)tuple_ptr + field_id);
+                uint16_t field_end_pos   = field_id < field_data_num
+                                             ? *((const uint16_t*)tuple_ptr + field_id + 1)
+                                             : (uint16_t)(tuple_end_ptr - tuple_ptr);
+                views->fields.push_back(FieldView{plan.columns[i], tuple_ptr + field_start_pos,
+                                                  (uint16_t)(field_end_pos - field_start_pos)});
+            }
+        }
+        views->tuple_ends.push_back((uint32_t)views->fields.size());
+        if ((const uint8_t*)line_pos_ptr - page_start_ptr > pd_lower) {
+            debug_error("line_pos > pd_lower error.\n");
+        }
+    }
 }
 
-const std::vector<
-    std::vector<std::pair<std::shared_ptr<ColumnTuple>, std::pair<uint8_t*, uint16_t>>>>
-BufferManager::getPageAllTupleUserData(const char* table_name, IdentList* column_ident_list,
-                                       PageId page_id) {
-    auto table_oid          = getTableOid(table_name);
-    Oid db_node             = table_oid.first;
-    Oid rel_node            = table_oid.second;
-    BufferTag buffer_tag    = BufferTag{db_node, rel_node, 0, page_id, table_name};
-    BufferId buffer_id      = getDataEntry(buffer_tag);
-    uint8_t* page_start_ptr = (uint8_t*)&buffer_pool[buffer_id.id];
-    uint16_t pd_lower       = buffer_pool[buffer_id.id].heap_header_info.pd_lower;
+void BufferManager::loadColumnBlock(const ProjectionPlan& plan, size_t column_index,
+                                    uint64_t block_id, PageTupleViews* views, bool read_ahead,
+                                    BufferAccessStrategy* strategy) {
+    // decode block block_id of the segment of plan.columns[column_index] into column_blocks.
+    BufferTag segment_tag = BufferTag{plan.db_node, plan.rel_node, plan.segment_fds[column_index],
+                                      block_id, plan.table_name};
+    // rows only go to the last block, so a block is complete once a later one exists.
+    bool complete = block_id + 1 < disk_manager->getRelation(segment_tag.fd)->block_num;
+    if (read_ahead) {
+        readAhead(segment_tag, &views->segment_read_ahead[column_index], strategy);
+    }
+    PageGuard page_guard;
+    const BufferPage* page = nullptr;
+    if (disk_manager->isMmapReads()) {
+        if (views->mapped_page == nullptr) {
+            views->mapped_page = std::make_unique<BufferPage>();
+        }
+        if (readMappedPage(segment_tag, views->mapped_page.get())) {
+            page = views->mapped_page.get();
+        }
+    }
+    if (page == nullptr) {
+        page_guard = fetchPage(segment_tag, strategy);
+        page_guard.lockShared();
+        page = page_guard.getPage();
+    }
+    ColumnBlockHeader block_header = columnBlockHeader(page);
+    const ColumnTuple* column      = plan.columns[column_index];
+    ColumnBlockCursor& block       = views->column_blocks[column_index];
+    block.block_id                 = block_id;
+    block.first_row                = block_header.first_row;
+    block.row_num                  = block_header.row_num;
+    block.complete                 = complete;
+    block.values.assign((size_t)block.row_num * column->type_size, 0);
+    decodeColumnBlock(page, column, block.row_num, block.values.data());
+}
 
-    // select target column
-    auto table_info_header = buffer_table_info[table_name];
-    assert(NULL != table_info_header);
-    auto column_tuple_list = column_list_map[table_info_header->rel_node];
-    assert(column_tuple_list.size() > 0);
-    std::unordered_map<uint32_t, std::shared_ptr<ColumnTuple>> column_id_map;
-    for (auto target_ident = column_ident_list; target_ident != NULL;
-         target_ident      = target_ident->next) {
-        for (uint32_t i = 0; i < column_tuple_list.size(); i++) {
-            if (!strcmp(target_ident->ident, column_tuple_list[i]->column_ident)) {
-                column_id_map[i + 1] = column_tuple_list[i];
+const ColumnBlockCursor& BufferManager::seekColumnBlock(const ProjectionPlan& plan,
+                                                        size_t column_index, uint64_t row_id,
+                                                        PageTupleViews* views, bool read_ahead,
+                                                        BufferAccessStrategy* strategy) {
+    // the block of the segment of plan.columns[column_index] which holds row row_id. a scan
+    // moves forward, so it is the block read last, which may have grown since unless it was
+    // complete, or one after it. otherwise the block headers are searched.
+    ColumnBlockCursor& block = views->column_blocks[column_index];
+    auto holds_row           = [&block, row_id]() {
+        return block.first_row <= row_id && row_id < block.first_row + block.row_num;
+    };
+    if (holds_row()) {
+        return block;
+    }
+    uint64_t block_num =
+        disk_manager->getRelation(plan.segment_fds[column_index])->block_num;
+    uint64_t block_id;
+    if (block.block_id != UINT64_MAX && block.first_row <= row_id) {
+        block_id = block.complete ? block.block_id + 1 : block.block_id;
+    } else {
+        // the last block whose first row is not after row_id
+        uint64_t low = 0, high = block_num;
+        while (high - low > 1) {
+            uint64_t middle = low + (high - low) / 2;
+            loadColumnBlock(plan, column_index, middle, views, false, strategy);
+            if (block.row_num > 0 && block.first_row <= row_id) {
+                low = middle;
+            } else {
+                high = middle;
             }
         }
+        block_id = low;
     }
-    std::vector<std::vector<std::pair<std::shared_ptr<ColumnTuple>, std::pair<uint8_t*, uint16_t>>>>
-        page_all_tuple_user_data = {};
-    // operate every tuple
-    for (uint16_t* line_pos_ptr = (uint16_t*)(page_start_ptr + sizeof(HeapHeaderInfo));
-         (uint8_t*)line_pos_ptr - page_start_ptr != pd_lower; ++line_pos_ptr) {
-        page_all_tuple_user_data.push_back({});
-        uint8_t* tuple_ptr     = page_start_ptr + *line_pos_ptr;
-        uint8_t* tuple_end_ptr = (uint16_t*)(page_start_ptr + sizeof(HeapHeaderInfo)) < line_pos_ptr
-                                     ? page_start_ptr + *(line_pos_ptr - 1)
-                                     : page_start_ptr + PAGE_TABLE_SIZE;
-        uint16_t field_data_num = *(uint16_t*)(tuple_ptr);
-        // operate every user_data in tuple, and collect target column data
-        for (int field_id = 1; field_id <= field_data_num; ++field_id) {
-            if (NULL == column_id_map[field_id]) {
-                continue;
-            }
-            uint16_t field_start_pos = *((uint16_t*)tuple_ptr + field_id);
-            uint16_t field_end_pos   = field_id < field_data_num
-                                         ? *((uint16_t*)tuple_ptr + field_id + 1)
-                                         : (uint16_t)(tuple_end_ptr - tuple_ptr);
-            uint16_t field_data_size   = field_end_pos - field_start_pos;
-            uint8_t* target_field_data = (uint8_t*)calloc(1, field_data_size + 1);
-            memcpy(target_field_data, tuple_ptr + field_start_pos, field_data_size);
-            page_all_tuple_user_data.back().push_back(std::make_pair(
-                column_id_map[field_id], std::make_pair(target_field_data, field_data_size)));
-        }
-        if ((uint8_t*)line_pos_ptr - page_start_ptr > pd_lower) {
-            debug_error("line_pos > pd_lower error.\n");
+    for (; block_id < block_num; block_id++) {
+        loadColumnBlock(plan, column_index, block_id, views, read_ahead, strategy);
+        if (holds_row()) {
+            return block;
         }
     }
-
-    return page_all_tuple_user_data;
+    debug_error("segments of a columnar table differ at seekColumnBlock.\n");
+    return block;
 }
 
 void BufferManager::insertOneTupleToOnlyTable(ValueList* value_list, const char* table_name) {
-    if (!PRODUCTION) BufferManager::createDataFile(table_name);
     auto table_oid = BufferManager::getTableOid(table_name);  // ->first: db_oid, ->second: rel_oid
-    uint64_t last_page_id = getTablePageNum(table_name);
-    // Prevent bugs when the page num is 0
-    if (last_page_id > 0) --last_page_id;
-    // std::cout << "last_page_id: " << last_page_id << std::endl;
 
-    BufferTag buffer_tag =
-        BufferTag{table_oid.first, table_oid.second, 0, last_page_id, table_name};
-    BufferId buffer_id = getDataEntry(buffer_tag);
-
-    uint16_t pd_lower = buffer_pool[buffer_id.id].heap_header_info.pd_lower;
-    uint16_t pd_upper = buffer_pool[buffer_id.id].heap_header_info.pd_upper;
-    uint8_t* page_ptr = (uint8_t*)&buffer_pool[buffer_id.id];
+    TupleLayout tuple_layout;
+    std::vector<std::shared_ptr<ColumnTuple>> column_tuple_list;
+    {
+        std::shared_lock<std::shared_mutex> catalog_guard(catalog_lock);
+        tuple_layout      = buffer_table_info.at(table_name)->tuple_layout;
+        column_tuple_list = column_list_map.at(table_oid.second);
+    }
 
     // get tuple size
     uint16_t field_num      = 0;
     uint16_t all_field_size = 0;
     for (ValueList* value = value_list; value != NULL; value = value->next) {
+        if (tuple_layout != TupleLayout::VARIABLE &&
+            (field_num >= column_tuple_list.size() ||
+             value->data_size > column_tuple_list[field_num]->type_size)) {
+            debug_error("value does not fit in the column at insertOneTupleToOnlyTable.\n");
+        }
         all_field_size += value->data_size;
         ++field_num;
     }
-    uint16_t tuple_size =
-        (uint16_t)(UINT16_BYTE_SIZE + UINT16_BYTE_SIZE * field_num + all_field_size);
+    uint16_t tuple_size;
+    if (tuple_layout != TupleLayout::VARIABLE) {
+        if (field_num != column_tuple_list.size()) {
+            debug_error("wrong number of values at insertOneTupleToOnlyTable.\n");
+        }
+        tuple_size = fixedTupleSize(column_tuple_list);
+    } else {
+        tuple_size = (uint16_t)(UINT16_BYTE_SIZE + UINT16_BYTE_SIZE * field_num + all_field_size);
+    }
+    // a PAX page has no line pos
+    uint16_t space_needed =
+        tuple_layout == TupleLayout::PAX ? tuple_size : tuple_size + UINT16_BYTE_SIZE;
+    if ((uint64_t)space_needed > HEAP_CONTENT_SIZE) {
+        debug_error("tuple is larger than a page at insertOneTupleToOnlyTable.\n");
+    }
+    if (tuple_layout == TupleLayout::COLUMNAR) {
+        std::vector<uint8_t> columnar_tuple(tuple_size);
+        fillFixedTuple(columnar_tuple.data(), column_tuple_list, value_list);
+        insertColumnarTuple(table_name, column_tuple_list, columnar_tuple.data());
+        return;
+    }
+    RelationFile* relation_file = disk_manager->openRelation(table_name, !PRODUCTION);
+    int fd                      = relation_file->fd;
+
+    // ask the free space map for a page, or take the last page.
+    int64_t free_page_id = getPageWithFreeSpace(table_name, space_needed);
+    uint64_t target_page_id;
+    if (free_page_id >= 0) {
+        target_page_id = (uint64_t)free_page_id;
+    } else {
+        target_page_id = relation_file->block_num;
+        // Prevent bugs when the page num is 0
+        if (target_page_id > 0) --target_page_id;
+    }
 
-    // need new page
-    if (pd_upper - pd_lower < tuple_size + UINT16_BYTE_SIZE) {
-        buffer_tag = BufferTag{table_oid.first, table_oid.second, 0, last_page_id + 1, table_name};
-        buffer_id  = getDataEntry(buffer_tag);
-        pd_lower   = buffer_pool[buffer_id.id].heap_header_info.pd_lower;
-        pd_upper   = buffer_pool[buffer_id.id].heap_header_info.pd_upper;
-        page_ptr   = (uint8_t*)&buffer_pool[buffer_id.id];
+    BufferTag buffer_tag =
+        BufferTag{table_oid.first, table_oid.second, fd, target_page_id, table_name};
+    PageGuard page_guard = fetchPage(buffer_tag);
+    page_guard.lockExclusive();
+
+    uint16_t pd_lower = page_guard.getPage()->heap_header_info.pd_lower;
+    uint16_t pd_upper = page_guard.getPage()->heap_header_info.pd_upper;
+    uint8_t* page_ptr = (uint8_t*)page_guard.getPage();
+
+    // need new page. other threads may fill the new page before we lock it, so try again.
+    while (pd_upper - pd_lower < space_needed) {
+        // the free space map did not know this page is full. unpin the page before touching the
+        // map, so that a pool of a single buffer still works.
+        page_guard.release();
+        recordFreeSpace(table_name, target_page_id, pd_upper - pd_lower);
+        target_page_id = relation_file->block_num;
+        buffer_tag = BufferTag{table_oid.first, table_oid.second, fd, target_page_id, table_name};
+        page_guard = fetchPage(buffer_tag);
+        page_guard.lockExclusive();
+        pd_lower   = page_guard.getPage()->heap_header_info.pd_lower;
+        pd_upper   = page_guard.getPage()->heap_header_info.pd_upper;
+        page_ptr   = (uint8_t*)page_guard.getPage();
     }
 
     // insert tuple
-    uint16_t target_tuple_pos = pd_upper - tuple_size;
-    assert(sizeof(HeapHeaderInfo) < target_tuple_pos && target_tuple_pos < pd_upper);
-    // tuple_ptr is start pointer to new tuple
-    uint8_t* tuple_ptr      = page_ptr + target_tuple_pos;
-    ValueList* target_value = value_list;
-    // field_num copy
-    memcpy((uint16_t*)tuple_ptr, &field_num, sizeof(uint16_t));
-    uint16_t* field_pos_ptr = (uint16_t*)tuple_ptr + 1;
-    uint8_t* field_data_ptr = (uint8_t*)((uint16_t*)tuple_ptr + 1 + field_num);
-    // copy every value to buffer_pool
-    for (; target_value != NULL; target_value = target_value->next) {
-        memcpy(field_data_ptr, target_value->binary_data, target_value->data_size);
-        uint16_t field_pos = (uint16_t)(field_data_ptr - tuple_ptr);
-        memcpy(field_pos_ptr, &field_pos, sizeof(uint16_t));
-        // increment
-        ++field_pos_ptr;
-        field_data_ptr += target_value->data_size;
-    }
-    assert(field_data_ptr == page_ptr + pd_upper);
-
-    // insert tuple line_pos
-    uint16_t* target_line_pos_ptr = (uint16_t*)(page_ptr + pd_lower);
-    memcpy(target_line_pos_ptr, &target_tuple_pos, sizeof(uint16_t));
-
-    // update pd_lower and pd_upper
-    buffer_pool[buffer_id.id].heap_header_info.pd_lower += sizeof(uint16_t);
-    buffer_pool[buffer_id.id].heap_header_info.pd_upper -= tuple_size;
-
-    // set a dirty flag
-    buffer_descriptor[buffer_id.id].flags = PageFlags::DIRTY;
-}
-
-void BufferManager::addNewTableToBuffer(const char* table_name, IdentList* ident_list) {
+    uint8_t* tuple_ptr;
+    std::vector<uint8_t> pax_tuple;
+    if (tuple_layout == TupleLayout::PAX) {
+        // the tuple is built in the fixed-width layout, which is also what the WAL records.
+        pax_tuple.resize(tuple_size);
+        tuple_ptr = pax_tuple.data();
+        fillFixedTuple(tuple_ptr, column_tuple_list, value_list);
+        paxInsertTuple(page_guard.getPage(), column_tuple_list, tuple_ptr);
+    } else {
+        uint16_t target_tuple_pos = pd_upper - tuple_size;
+        assert(sizeof(HeapHeaderInfo) < target_tuple_pos && target_tuple_pos < pd_upper);
+        // tuple_ptr is start pointer to new tuple
+        tuple_ptr = page_ptr + target_tuple_pos;
+        if (tuple_layout == TupleLayout::FIXED) {
+            fillFixedTuple(tuple_ptr, column_tuple_list, value_list);
+        } else {
+            // field_num copy
+            memcpy((uint16_t*)tuple_ptr, &field_num, sizeof(uint16_t));
+            uint16_t* field_pos_ptr = (uint16_t*)tuple_ptr + 1;
+            uint8_t* field_data_ptr = (uint8_t*)((uint16_t*)tuple_ptr + 1 + field_num);
+            // copy every value to buffer_pool
+            for (ValueList* target_value = value_list; target_value != NULL;
+                 target_value            = target_value->next) {
+                memcpy(field_data_ptr, target_value->binary_data, target_value->data_size);
+                uint16_t field_pos = (uint16_t)(field_data_ptr - tuple_ptr);
+                memcpy(field_pos_ptr, &field_pos, sizeof(uint16_t));
+                // increment
+                ++field_pos_ptr;
+                field_data_ptr += target_value->data_size;
+            }
+            assert(field_data_ptr == page_ptr + pd_upper);
+        }
+
+        // insert tuple line_pos
+        uint16_t* target_line_pos_ptr = (uint16_t*)(page_ptr + pd_lower);
+        memcpy(target_line_pos_ptr, &target_tuple_pos, sizeof(uint16_t));
+
+        // update pd_lower and pd_upper
+        page_guard.getPage()->heap_header_info.pd_lower += sizeof(uint16_t);
+        page_guard.getPage()->heap_header_info.pd_upper -= tuple_size;
+    }
+
+    // set a dirty flag before logging, so that a checkpoint whose redo point comes after the
+    // record finds the page dirty.
+    page_guard.markDirty();
+
+    // log the insert while the page is locked, so that records of a page are in lsn order.
+    // the first change after the redo point logs the whole page, unless the page was empty.
+    uint16_t table_name_len = (uint16_t)strlen(table_name);
+    bool init_page          = pd_lower == sizeof(HeapHeaderInfo);
+    std::vector<WalPayload> payload = {{&table_name_len, sizeof(uint16_t)},
+                                       {table_name, table_name_len},
+                                       {&target_page_id, sizeof(uint64_t)},
+                                       {tuple_ptr, tuple_size}};
+    std::vector<WalPayload> full_page_payload = payload;
+    full_page_payload.back()                  = WalPayload{page_ptr, PAGE_TABLE_SIZE};
+    uint64_t insert_lsn = wal_manager->insertRecord(
+        WalRecordType::INSERT, init_page ? WAL_INSERT_INIT_PAGE : 0, payload,
+        page_guard.getPage()->heap_header_info.pd_lsn, init_page ? nullptr : &full_page_payload);
+    page_guard.getPage()->heap_header_info.pd_lsn = insert_lsn;
+
+    uint16_t free_space = page_guard.getPage()->heap_header_info.pd_upper -
+                          page_guard.getPage()->heap_header_info.pd_lower;
+    page_guard.release();
+    recordFreeSpace(table_name, target_page_id, free_space);
+
+    // commit. concurrent inserts share one fdatasync.
+    wal_manager->flush(insert_lsn);
+}
+
+void BufferManager::insertColumnarTuple(
+    const char* table_name, const std::vector<std::shared_ptr<ColumnTuple>>& column_tuple_list,
+    const uint8_t* tuple_ptr) {
+    // the inserts into a table are serialized, and the row is appended to one segment at a time
+    // from the last column to the first, so an insert pins one block whatever the number of
+    // columns. the first selected segment of a scan gets the row after the other selected ones.
+    auto table_oid = getTableOid(table_name);
+    std::mutex* insert_lock;
+    {
+        std::shared_lock<std::shared_mutex> catalog_guard(catalog_lock);
+        insert_lock = columnar_insert_locks.at(table_oid.second).get();
+    }
+    std::unique_lock<std::mutex> insert_guard(*insert_lock);
+    // no redo point between the records of the row, see redoInsertRecords.
+    std::shared_lock<std::shared_mutex> delay_guard(checkpoint_delay_lock);
+    uint64_t row_id     = UINT64_MAX;
+    uint64_t insert_lsn = 0;
+    for (size_t i = column_tuple_list.size(); i-- > 0;) {
+        insert_lsn = appendColumnValue(table_name, column_tuple_list, i, tuple_ptr, &row_id);
+    }
+    delay_guard.unlock();
+    insert_guard.unlock();
+
+    // commit. concurrent inserts share one fdatasync.
+    wal_manager->flush(insert_lsn);
+}
+
+uint64_t BufferManager::appendColumnValue(
+    const char* table_name, const std::vector<std::shared_ptr<ColumnTuple>>& column_tuple_list,
+    size_t column_id, const uint8_t* tuple_ptr, uint64_t* row_id) {
+    // the value of column column_id goes to the last block of its segment, or to a new block
+    // where it does not fit. *row_id is taken from the segment if it is UINT64_MAX.
+    auto table_oid = getTableOid(table_name);
+    RelationFile* segment_file =
+        disk_manager->openRelation(columnSegmentName(table_name, column_id).c_str(), true);
+    const ColumnTuple* column = column_tuple_list[column_id].get();
+    const uint8_t* field      = tuple_ptr + column->fixed_offset;
+    uint64_t block_id         = segment_file->block_num;
+    if (block_id > 0) --block_id;
+    PageGuard page_guard;
+    bool init_page;
+    for (;;) {
+        BufferTag segment_tag = BufferTag{table_oid.first, table_oid.second, segment_file->fd,
+                                          block_id, segment_file->relation_name};
+        page_guard            = fetchPage(segment_tag);
+        page_guard.lockExclusive();
+        BufferPage* page               = page_guard.getPage();
+        ColumnBlockHeader block_header = columnBlockHeader(page);
+        if (block_header.row_num > 0) {
+            uint64_t end_row = block_header.first_row + block_header.row_num;
+            if (*row_id == UINT64_MAX) {
+                *row_id = end_row;
+            } else if (end_row != *row_id) {
+                debug_error("segments of a columnar table differ at appendColumnValue.\n");
+            }
+        }
+        if (columnAppendSize(page, column, field) <=
+            page->heap_header_info.pd_upper - page->heap_header_info.pd_lower) {
+            init_page = block_header.row_num == 0;
+            break;
+        }
+        if (block_header.row_num == 0) {
+            debug_error("value is larger than a block at appendColumnValue.\n");
+        }
+        page_guard.release();
+        block_id = segment_file->block_num;
+    }
+    if (*row_id == UINT64_MAX) {
+        *row_id = 0;
+    }
+
+    BufferPage* page  = page_guard.getPage();
+    uint64_t page_lsn = page->heap_header_info.pd_lsn;
+    columnAppend(page, column, field, *row_id);
+    page_guard.markDirty();
+
+    // the record of the last column, which is logged first, has the whole tuple.
+    uint16_t table_name_len   = (uint16_t)strlen(table_name);
+    uint16_t record_column_id = (uint16_t)column_id;
+    WalPayload value          = column_id + 1 == column_tuple_list.size()
+                                    ? WalPayload{tuple_ptr, fixedTupleSize(column_tuple_list)}
+                                    : WalPayload{field, column->type_size};
+    std::vector<WalPayload> payload = {{&table_name_len, sizeof(uint16_t)},
+                                       {table_name, table_name_len},
+                                       {&block_id, sizeof(uint64_t)},
+                                       {&record_column_id, sizeof(uint16_t)},
+                                       {row_id, sizeof(uint64_t)},
+                                       value};
+    std::vector<WalPayload> full_page_payload = payload;
+    full_page_payload.push_back(WalPayload{page, PAGE_TABLE_SIZE});
+    uint64_t insert_lsn = wal_manager->insertRecord(
+        WalRecordType::INSERT, init_page ? WAL_INSERT_INIT_PAGE : 0, payload, page_lsn,
+        init_page ? nullptr : &full_page_payload);
+    page->heap_header_info.pd_lsn = insert_lsn;
+    page_guard.release();
+    return insert_lsn;
+}
+
+uint64_t BufferManager::getColumnSegmentRowNum(const char* table_name, size_t column_id) {
+    // the rows of a segment end with its last block.
+    auto table_oid = getTableOid(table_name);
+    RelationFile* segment_file =
+        disk_manager->openRelation(columnSegmentName(table_name, column_id).c_str(), true);
+    if (segment_file->block_num == 0) {
+        return 0;
+    }
+    BufferTag segment_tag = BufferTag{table_oid.first, table_oid.second, segment_file->fd,
+                                      segment_file->block_num - 1, segment_file->relation_name};
+    PageGuard page_guard  = fetchPage(segment_tag);
+    page_guard.lockShared();
+    ColumnBlockHeader block_header = columnBlockHeader(page_guard.getPage());
+    return block_header.first_row + block_header.row_num;
+}
+
+BufferTag BufferManager::getFreeSpaceMapTag(const char* table_name, uint64_t fsm_block_id) {
+    // the free space map is cached in the buffer pool as the pages of its own fork file.
+    auto table_oid = getTableOid(table_name);
+    int fsm_fd =
+        disk_manager->openRelation((std::string(table_name) + FSM_FORK_SUFFIX).c_str(), true)->fd;
+    return BufferTag{table_oid.first, table_oid.second, fsm_fd, fsm_block_id, table_name};
+}
+
+void BufferManager::recordFreeSpace(const char* table_name, PageId page_id, uint16_t free_space) {
+    // called whenever the free space of a heap page changes (insert now, delete in the future).
+    uint8_t category     = (uint8_t)std::min(free_space / FSM_CATEGORY_SIZE, 255);
+    BufferTag fsm_tag    = getFreeSpaceMapTag(table_name, page_id / HEAP_CONTENT_SIZE);
+    PageGuard page_guard = fetchPage(fsm_tag);
+    page_guard.lockExclusive();
+    BufferPage* fsm_page = page_guard.getPage();
+    uint8_t* slot        = &fsm_page->heap_content[page_id % HEAP_CONTENT_SIZE];
+    if (*slot == category) {
+        return;
+    }
+    *slot = category;
+    if (fsm_page->heap_header_info.pd_special < category) {
+        fsm_page->heap_header_info.pd_special = category;
+    }
+    page_guard.markDirty();
+}
+
+int64_t BufferManager::getPageWithFreeSpace(const char* table_name, uint16_t space_needed) {
+    // first fit. pd_special of a free space map page is an upper bound of its categories, so
+    // pages without enough space are skipped, and the bound is tightened after a failed search.
+    uint64_t needed         = (space_needed + FSM_CATEGORY_SIZE - 1) / FSM_CATEGORY_SIZE;
+    uint64_t heap_block_num = disk_manager->openRelation(table_name, false)->block_num;
+    BufferTag fsm_tag       = getFreeSpaceMapTag(table_name, 0);
+    uint64_t fsm_block_num  = disk_manager->getRelation(fsm_tag.fd)->block_num;
+    for (; fsm_tag.heap_file_block_id < fsm_block_num; ++fsm_tag.heap_file_block_id) {
+        // exclusive, since the bound may be tightened
+        PageGuard page_guard = fetchPage(fsm_tag);
+        page_guard.lockExclusive();
+        BufferPage* fsm_page = page_guard.getPage();
+        if (fsm_page->heap_header_info.pd_special < needed) {
+            continue;
+        }
+        uint64_t first_block = fsm_tag.heap_file_block_id * HEAP_CONTENT_SIZE;
+        if (first_block >= heap_block_num) {
+            break;
+        }
+        uint64_t slot_num    = std::min(HEAP_CONTENT_SIZE, heap_block_num - first_block);
+        uint8_t max_category = 0;
+        for (uint64_t i = 0; i < slot_num; i++) {
+            if (fsm_page->heap_content[i] >= needed) {
+                return (int64_t)(first_block + i);
+            }
+            max_category = std::max(max_category, fsm_page->heap_content[i]);
+        }
+        if (fsm_page->heap_header_info.pd_special != max_category) {
+            fsm_page->heap_header_info.pd_special = max_category;
+            page_guard.markDirty();
+        }
+    }
+    return -1;
+}
+
+void BufferManager::addNewTableToBuffer(const char* table_name, IdentList* ident_list,
+                                        TableStorage table_storage) {
+    std::unique_lock<std::shared_mutex> catalog_guard(catalog_lock);
     if (!PRODUCTION) BufferManager::createDataFile(SCHEMA_FILE_NAME);
     // generate random number for RelNode;
     std::random_device rd;
@@ -468,6 +2082,29 @@ void BufferManager::addNewTableToBuffer(const char* table_name, IdentList* ident
         }
         table_info_header->column_num      = column_num;
         table_info_header->table_info_size = table_info_size;
+        // padded CHAR(n) values make FIXED rows larger than VARIABLE ones, so it is opt-in.
+        bool fixed_width                = setFixedOffsets(column_tuple_list);
+        table_info_header->tuple_layout = TupleLayout::VARIABLE;
+        if (fixed_width && PAX_PAGES) {
+            table_info_header->tuple_layout = TupleLayout::PAX;
+        } else if (fixed_width && FIXED_TUPLES) {
+            table_info_header->tuple_layout = TupleLayout::FIXED;
+        }
+        if (table_storage == TableStorage::COLUMNAR_STORAGE) {
+            // the segments are appended fixed-width tuples, and any value must fit in a block.
+            if (!fixed_width) {
+                debug_error("columnar table needs fixed-width columns at addNewTableToBuffer.\n");
+            }
+            for (auto&& column_tuple : column_tuple_list) {
+                uint16_t type_size = column_tuple->type_size;
+                if (sizeof(ColumnBlockHeader) + UINT16_BYTE_SIZE + varintSize(type_size) +
+                        type_size >
+                    HEAP_CONTENT_SIZE) {
+                    debug_error("column is larger than a block at addNewTableToBuffer.\n");
+                }
+            }
+            table_info_header->tuple_layout = TupleLayout::COLUMNAR;
+        }
     }
 
     // copy column tuple to schema page
@@ -505,10 +2142,18 @@ void BufferManager::addNewTableToBuffer(const char* table_name, IdentList* ident
             column_tuple_size_list_iter++;
         }
         assert(new_table_ptr + end_pos == cur_column_pos_ptr);
+
+        // the schema file is written right below, so the record must be durable before it.
+        uint64_t create_lsn = wal_manager->insertRecord(
+            WalRecordType::CREATE_TABLE, 0, {{new_table_ptr, table_info_header->table_info_size}});
+        wal_manager->flush(create_lsn);
     }
 
     column_list_map[table_info_header->rel_node]     = column_tuple_list;
     buffer_table_info[table_info_header->table_name] = table_info_header;
+    if (table_info_header->tuple_layout == TupleLayout::COLUMNAR) {
+        columnar_insert_locks[table_info_header->rel_node] = std::make_unique<std::mutex>();
+    }
     schema_info.schema_info_header.table_num++;
     schema_info.schema_info_header.pd_lower += table_info_header->table_info_size;
 
@@ -519,6 +2164,12 @@ void BufferManager::addNewTableToBuffer(const char* table_name, IdentList* ident
 }
 
 void BufferManager::getAllTableToCache() {
+    // crash recovery: the WAL after the redo point of the last checkpoint is replayed before
+    // any table is used.
+    std::vector<uint8_t> wal_records;
+    wal_manager->readValidRecords(wal_manager->getRedoLsn(), &wal_records);
+
+    std::unique_lock<std::shared_mutex> catalog_guard(catalog_lock);
     // open schema file
     std::ifstream ifs(PROJECT_PATH + std::string(SCHEMA_FILE_NAME),
                       std::ios::binary | std::ios::in);
@@ -548,8 +2199,23 @@ void BufferManager::getAllTableToCache() {
         ifs_2.close();
         schema_info.schema_info_header.table_num = 0;
         schema_info.schema_info_header.pd_lower  = sizeof(SchemaInfoHeader);
-        table_info_flags                         = PageFlags::VALID;
-        return;
+    }
+
+    // redo the tables created after the schema file was last written.
+    bool schema_changed = false;
+    for (size_t pos = 0; pos < wal_records.size();) {
+        WalRecordHeader header;
+        memcpy(&header, wal_records.data() + pos, sizeof(WalRecordHeader));
+        if (header.type == WalRecordType::CREATE_TABLE) {
+            schema_changed |=
+                redoCreateTable(wal_records.data() + pos + sizeof(WalRecordHeader),
+                                (uint16_t)(header.total_size - sizeof(WalRecordHeader)));
+        }
+        pos += header.total_size;
+    }
+    if (schema_changed) {
+        table_info_flags = PageFlags::DIRTY;
+        tablePageFlush();
     }
 
     // read every table information
@@ -572,8 +2238,7 @@ void BufferManager::getAllTableToCache() {
                 std::shared_ptr<ColumnTuple> column_tuple = std::make_shared<ColumnTuple>();
                 column_tuple->column_ident_len            = *(uint16_t*)cur_ptr;
                 cur_ptr += sizeof(uint16_t);
-                column_tuple->column_ident =
-                    (char*)calloc(1, sizeof(column_tuple->column_ident_len));
+                column_tuple->column_ident = (char*)calloc(1, column_tuple->column_ident_len + 1);
                 memcpy(column_tuple->column_ident, cur_ptr, column_tuple->column_ident_len);
                 cur_ptr += column_tuple->column_ident_len;
                 column_tuple->type = static_cast<DataType>(*(uint8_t*)(cur_ptr));
@@ -583,10 +2248,305 @@ void BufferManager::getAllTableToCache() {
                 column_tuple->attribute = static_cast<ColumnAttribute>(*(uint8_t*)cur_ptr);
                 column_tuple_list.push_back(column_tuple);
             }
+            if (table_info_header->tuple_layout != TupleLayout::VARIABLE &&
+                !setFixedOffsets(column_tuple_list)) {
+                debug_error("fixed-width table does not fit in a page at getAllTableToCache.\n");
+            }
 
             column_list_map[table_info_header->rel_node]     = column_tuple_list;
             buffer_table_info[table_info_header->table_name] = table_info_header;
+            if (table_info_header->tuple_layout == TupleLayout::COLUMNAR) {
+                columnar_insert_locks[table_info_header->rel_node] =
+                    std::make_unique<std::mutex>();
+            }
+            target_table_ptr += table_info_header->table_info_size;
         }
     }
     table_info_flags = PageFlags::VALID;
+    catalog_guard.unlock();
+
+    redoInsertRecords(wal_records);
+    recovery_done = true;
+}
+
+bool BufferManager::redoCreateTable(const uint8_t* table_info, uint16_t table_info_size) {
+    // called with catalog_lock held exclusively. the record is skipped if the table is already
+    // in the schema.
+    const TableInfoHeader* new_table_info_header = (const TableInfoHeader*)table_info;
+    uint8_t* page_ptr                            = (uint8_t*)&schema_info;
+    uint8_t* target_table_ptr                    = page_ptr + sizeof(SchemaInfoHeader);
+    for (uint64_t i = 0; i < schema_info.schema_info_header.table_num; i++) {
+        TableInfoHeader* table_info_header = (TableInfoHeader*)target_table_ptr;
+        if (!strncmp(table_info_header->table_name, new_table_info_header->table_name,
+                     TABLE_NAME_SIZE)) {
+            return false;
+        }
+        target_table_ptr += table_info_header->table_info_size;
+    }
+    if (schema_info.schema_info_header.pd_lower + table_info_size > SCHEMA_FILE_SIZE) {
+        debug_error("schema is full at redoCreateTable.\n");
+    }
+    memcpy(page_ptr + schema_info.schema_info_header.pd_lower, table_info, table_info_size);
+    schema_info.schema_info_header.table_num++;
+    schema_info.schema_info_header.pd_lower += table_info_size;
+    return true;
+}
+
+void BufferManager::redoInsertRecords(const std::vector<uint8_t>& wal_records) {
+    // group the records by block. the records of a block are replayed in lsn order by one
+    // worker, and the blocks are spread over the workers, so the replay runs in parallel.
+    // a block is (table, segment, block id), where segment 0 is the heap file and segment i
+    // the segment of column i - 1 of a columnar table.
+    std::unordered_map<std::string, uint16_t> columnar_column_num;
+    {
+        std::shared_lock<std::shared_mutex> catalog_guard(catalog_lock);
+        for (auto&& [name, table_info_header] : buffer_table_info) {
+            if (table_info_header->tuple_layout == TupleLayout::COLUMNAR) {
+                columnar_column_num[name] = table_info_header->column_num;
+            }
+        }
+    }
+    std::map<std::tuple<std::string, uint16_t, uint64_t>, std::vector<size_t>> block_records;
+    std::unordered_map<std::string, size_t> last_columnar_rows;  // table -> record with the tuple
+    for (size_t pos = 0; pos < wal_records.size();) {
+        WalRecordHeader header;
+        memcpy(&header, wal_records.data() + pos, sizeof(WalRecordHeader));
+        if (header.type == WalRecordType::INSERT) {
+            const uint8_t* payload = wal_records.data() + pos + sizeof(WalRecordHeader);
+            uint16_t table_name_len;
+            uint64_t block_id;
+            memcpy(&table_name_len, payload, sizeof(uint16_t));
+            memcpy(&block_id, payload + sizeof(uint16_t) + table_name_len, sizeof(uint64_t));
+            std::string table_name((const char*)payload + sizeof(uint16_t), table_name_len);
+            auto columnar = columnar_column_num.find(table_name);
+            if (columnar == columnar_column_num.end()) {
+                block_records[{table_name, 0, block_id}].push_back(pos);
+            } else {
+                uint16_t column_id;
+                memcpy(&column_id, payload + sizeof(uint16_t) + table_name_len + sizeof(uint64_t),
+                       sizeof(uint16_t));
+                block_records[{table_name, column_id + 1, block_id}].push_back(pos);
+                if (column_id + 1 == columnar->second) {
+                    last_columnar_rows[table_name] = pos;
+                }
+            }
+        }
+        pos += header.total_size;
+    }
+    if (block_records.empty()) {
+        return;
+    }
+
+    std::vector<
+        std::pair<const std::tuple<std::string, uint16_t, uint64_t>, std::vector<size_t>>*>
+        blocks;
+    for (auto&& block : block_records) {
+        blocks.push_back(&block);
+    }
+    // every worker pins one heap page and then one free space map page at a time.
+    uint32_t worker_num = std::max(1u, std::min({std::thread::hardware_concurrency(),
+                                                 page_nums / 4, (uint32_t)blocks.size()}));
+    std::vector<std::thread> workers;
+    for (uint32_t worker_id = 0; worker_id < worker_num; worker_id++) {
+        workers.emplace_back([this, &blocks, &wal_records, worker_id, worker_num]() {
+            for (size_t i = worker_id; i < blocks.size(); i += worker_num) {
+                auto&& [table_name, segment, block_id] = blocks[i]->first;
+                if (segment == 0) {
+                    redoBlock(table_name.c_str(), block_id, wal_records, blocks[i]->second);
+                } else {
+                    redoColumnarBlock(table_name.c_str(), segment - 1, block_id, wal_records,
+                                      blocks[i]->second);
+                }
+            }
+        });
+    }
+    for (auto&& worker : workers) {
+        worker.join();
+    }
+
+    // a columnar row is logged from the last column to the first, and a checkpoint takes no
+    // redo point between its records. so a row which the crash left in only some segments has
+    // its first record, with the whole tuple, in the replayed WAL, and is finished from it.
+    for (auto&& [table_name, pos] : last_columnar_rows) {
+        const uint8_t* payload = wal_records.data() + pos + sizeof(WalRecordHeader);
+        size_t row_id_offset =
+            sizeof(uint16_t) + table_name.size() + sizeof(uint64_t) + sizeof(uint16_t);
+        uint64_t row_id;
+        memcpy(&row_id, payload + row_id_offset, sizeof(uint64_t));
+        const uint8_t* tuple_ptr = payload + row_id_offset + sizeof(uint64_t);
+        std::vector<std::shared_ptr<ColumnTuple>> column_tuple_list;
+        {
+            std::shared_lock<std::shared_mutex> catalog_guard(catalog_lock);
+            column_tuple_list = column_list_map.at(buffer_table_info.at(table_name)->rel_node);
+        }
+        uint64_t insert_lsn = 0;
+        for (size_t i = column_tuple_list.size() - 1; i-- > 0;) {
+            uint64_t row_num = getColumnSegmentRowNum(table_name.c_str(), i);
+            if (row_num == row_id) {
+                insert_lsn = appendColumnValue(table_name.c_str(), column_tuple_list, i,
+                                               tuple_ptr, &row_id);
+            } else if (row_num != row_id + 1) {
+                debug_error("segments of a columnar table differ at redoInsertRecords.\n");
+            }
+        }
+        wal_manager->flush(insert_lsn);
+    }
+}
+
+void BufferManager::redoBlock(const char* table_name, uint64_t block_id,
+                              const std::vector<uint8_t>& wal_records,
+                              const std::vector<size_t>& offsets) {
+    // replay from the last record which was inserted into an empty page or has the whole page.
+    // then the page on disk is not even read, so a torn page is rebuilt too. without such a
+    // record, the page is read and the records it already has (end lsn <= pd_lsn) are skipped.
+    size_t first_record = 0;
+    bool init_page      = false;
+    for (size_t i = 0; i < offsets.size(); i++) {
+        WalRecordHeader header;
+        memcpy(&header, wal_records.data() + offsets[i], sizeof(WalRecordHeader));
+        if (header.flags & (WAL_INSERT_INIT_PAGE | WAL_FULL_PAGE_IMAGE)) {
+            first_record = i;
+            init_page    = true;
+        }
+    }
+
+    TupleLayout tuple_layout;
+    {
+        std::shared_lock<std::shared_mutex> catalog_guard(catalog_lock);
+        tuple_layout = buffer_table_info.at(table_name)->tuple_layout;
+    }
+    RelationFile* relation_file = disk_manager->openRelation(table_name, true);
+    auto table_oid              = getTableOid(relation_file->relation_name);
+    BufferTag buffer_tag = BufferTag{table_oid.first, table_oid.second, relation_file->fd,
+                                     block_id, relation_file->relation_name};
+    std::vector<std::shared_ptr<ColumnTuple>> column_tuple_list;
+    {
+        std::shared_lock<std::shared_mutex> catalog_guard(catalog_lock);
+        column_tuple_list = column_list_map.at(table_oid.second);
+    }
+    PageGuard page_guard = fetchPage(buffer_tag, nullptr, init_page);
+    page_guard.lockExclusive();
+    BufferPage* page                 = page_guard.getPage();
+    HeapHeaderInfo& heap_header_info = page->heap_header_info;
+    bool page_changed                = false;
+    for (size_t i = first_record; i < offsets.size(); i++) {
+        WalRecordHeader header;
+        memcpy(&header, wal_records.data() + offsets[i], sizeof(WalRecordHeader));
+        if (i == first_record && init_page) {
+            initPage(page);
+        }
+        uint64_t end_lsn = header.lsn + header.total_size;
+        if (end_lsn <= heap_header_info.pd_lsn) {
+            continue;
+        }
+        const uint8_t* payload = wal_records.data() + offsets[i] + sizeof(WalRecordHeader);
+        size_t tuple_offset    = sizeof(uint16_t) + strlen(table_name) + sizeof(uint64_t);
+        if (header.flags & WAL_FULL_PAGE_IMAGE) {
+            memcpy(page, payload + tuple_offset, PAGE_TABLE_SIZE);
+            heap_header_info.pd_lsn = end_lsn;
+            page_changed            = true;
+            continue;
+        }
+        uint16_t tuple_size =
+            (uint16_t)(header.total_size - sizeof(WalRecordHeader) - tuple_offset);
+        uint16_t space_needed =
+            tuple_layout == TupleLayout::PAX ? tuple_size : tuple_size + UINT16_BYTE_SIZE;
+        if (heap_header_info.pd_upper - heap_header_info.pd_lower < space_needed) {
+            debug_error("WAL record does not fit in the page at redoBlock.\n");
+        }
+        // the same steps as insertOneTupleToOnlyTable
+        if (tuple_layout == TupleLayout::PAX) {
+            paxInsertTuple(page, column_tuple_list, payload + tuple_offset);
+        } else {
+            heap_header_info.pd_upper -= tuple_size;
+            memcpy((uint8_t*)page + heap_header_info.pd_upper, payload + tuple_offset,
+                   tuple_size);
+            memcpy((uint8_t*)page + heap_header_info.pd_lower, &heap_header_info.pd_upper,
+                   sizeof(uint16_t));
+            heap_header_info.pd_lower += sizeof(uint16_t);
+        }
+        heap_header_info.pd_lsn = end_lsn;
+        page_changed            = true;
+    }
+    if (page_changed) {
+        page_guard.markDirty();
+    }
+
+    // the free space map is not logged, so bring it up to date with the page.
+    uint16_t free_space = heap_header_info.pd_upper - heap_header_info.pd_lower;
+    page_guard.release();
+    recordFreeSpace(relation_file->relation_name, block_id, free_space);
+}
+
+void BufferManager::redoColumnarBlock(const char* table_name, size_t column_id,
+                                      uint64_t block_id, const std::vector<uint8_t>& wal_records,
+                                      const std::vector<size_t>& offsets) {
+    // the same as redoBlock, for block block_id of the segment of column column_id.
+    auto table_oid = getTableOid(table_name);
+    std::vector<std::shared_ptr<ColumnTuple>> column_tuple_list;
+    {
+        std::shared_lock<std::shared_mutex> catalog_guard(catalog_lock);
+        column_tuple_list = column_list_map.at(table_oid.second);
+    }
+    const ColumnTuple* column = column_tuple_list[column_id].get();
+    size_t row_id_offset =
+        sizeof(uint16_t) + strlen(table_name) + sizeof(uint64_t) + sizeof(uint16_t);
+    // the record of the last column has the whole tuple.
+    size_t field_offset = row_id_offset + sizeof(uint64_t);
+    if (column_id + 1 == column_tuple_list.size()) {
+        field_offset += column->fixed_offset;
+    }
+    size_t first_record = 0;
+    bool init_page      = false;
+    for (size_t i = 0; i < offsets.size(); i++) {
+        WalRecordHeader header;
+        memcpy(&header, wal_records.data() + offsets[i], sizeof(WalRecordHeader));
+        if (header.flags & (WAL_INSERT_INIT_PAGE | WAL_FULL_PAGE_IMAGE)) {
+            first_record = i;
+            init_page    = true;
+        }
+    }
+
+    RelationFile* segment_file =
+        disk_manager->openRelation(columnSegmentName(table_name, column_id).c_str(), true);
+    BufferTag segment_tag = BufferTag{table_oid.first, table_oid.second, segment_file->fd,
+                                      block_id, segment_file->relation_name};
+    PageGuard page_guard  = fetchPage(segment_tag, nullptr, init_page);
+    page_guard.lockExclusive();
+    BufferPage* page  = page_guard.getPage();
+    bool page_changed = false;
+    for (size_t i = first_record; i < offsets.size(); i++) {
+        WalRecordHeader header;
+        memcpy(&header, wal_records.data() + offsets[i], sizeof(WalRecordHeader));
+        if (i == first_record && init_page) {
+            initPage(page);
+        }
+        uint64_t end_lsn = header.lsn + header.total_size;
+        if (end_lsn <= page->heap_header_info.pd_lsn) {
+            continue;
+        }
+        const uint8_t* payload = wal_records.data() + offsets[i] + sizeof(WalRecordHeader);
+        if (header.flags & WAL_FULL_PAGE_IMAGE) {
+            // the page follows the value.
+            memcpy(page, payload + header.total_size - sizeof(WalRecordHeader) - PAGE_TABLE_SIZE,
+                   PAGE_TABLE_SIZE);
+        } else {
+            uint64_t row_id;
+            memcpy(&row_id, payload + row_id_offset, sizeof(uint64_t));
+            ColumnBlockHeader block_header = columnBlockHeader(page);
+            const uint8_t* field           = payload + field_offset;
+            if ((block_header.row_num > 0 &&
+                 block_header.first_row + block_header.row_num != row_id) ||
+                columnAppendSize(page, column, field) >
+                    page->heap_header_info.pd_upper - page->heap_header_info.pd_lower) {
+                debug_error("WAL record does not fit in the block at redoColumnarBlock.\n");
+            }
+            columnAppend(page, column, field, row_id);
+        }
+        page->heap_header_info.pd_lsn = end_lsn;
+        page_changed                  = true;
+    }
+    if (page_changed) {
+        page_guard.markDirty();
+    }
 }
@@ -2,23 +2,39 @@
 #define _BUFFER_MANAGER_H_
 
 #include <stdint.h>
+#include <atomic>
 #include <cstdlib>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 #include "c_user_types.h"
+#include "disk.h"
 #include "util.h"
+#include "wal.h"
 
 typedef uint64_t Oid;
 typedef uint64_t PageId;
 typedef uint64_t RelNode;
 
-const uint32_t PAGE_NUMS        = 100;
-const uint64_t PAGE_TABLE_SIZE  = 8192;
-const uint32_t BUCKET_SLOT_SIZE = 100;
-const uint64_t DB_NODE          = 999;
-const uint64_t SCHEMA_FILE_SIZE = 8192 * 2;
-const uint64_t TABLE_NAME_SIZE  = 100;
+const uint32_t DEFAULT_PAGE_NUMS       = 100;
+const uint64_t PAGE_TABLE_SIZE         = 8192;
+const uint32_t NUM_BUFFER_PARTITIONS   = 16;
+const uint16_t BM_MAX_USAGE_COUNT      = 5;
+const uint64_t DB_NODE                 = 999;
+const uint64_t SCHEMA_FILE_SIZE        = 8192 * 2;
+const uint64_t TABLE_NAME_SIZE         = 100;
+const uint64_t HUGE_PAGE_SIZE          = 2 * 1024 * 1024;
+const uint32_t MAX_WRITE_COMBINE_PAGES = 32;
+const uint32_t MAX_READAHEAD_PAGES     = 64;
+const uint32_t BULKREAD_RING_PAGES     = 32;
+const uint32_t MAX_VICTIM_LAPS         = 10000;
+const uint32_t CHECKPOINT_POLL_MS      = 100;
 
 /*
     page structure (untrust memory)
@@ -55,6 +71,56 @@ const uint64_t TABLE_NAME_SIZE  = 100;
     ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
 */
 
+/*
+    fixed-width plain data tuple structure (TupleLayout::FIXED)
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    | field_data_1(type_size_1) | field_data_2(type_size_2) | ... |
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    ※ with --fixed-tuples, a table whose columns are all fixed-width (INTEGER, CHAR(n)) uses this
+      layout. the field offsets come from the schema, and a CHAR(n) value shorter than n is padded
+      with zeros, so it only pays off when the values mostly fill their columns.
+*/
+
+/*
+    PAX page structure (TupleLayout::PAX)
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    | pd_lsn(64) | pd_checksum(64) | pd_lower(16) | pd_upper(16) | pd_special(64) |
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    | minipage of column 1: field_data_1 of tuple 1 | field_data_1 of tuple 2 | ... |
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    | minipage of column 2: field_data_2 of tuple 1 | field_data_2 of tuple 2 | ... |
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    ...
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    ※ with --pax-pages, a fixed-width table stores the values of each column contiguously, so a
+      scan of a few columns only touches their minipages. A page holds capacity =
+      HEAP_CONTENT_SIZE / tuple_size tuples, and the minipage of a column starts at capacity *
+      fixed_offset. There is no line pos: pd_lower is the header size + tuple_num * tuple_size
+      and pd_upper is the header size + capacity * tuple_size, so pd_upper - pd_lower is still
+      the free space. An insert is logged as a fixed-width tuple.
+*/
+
+/*
+    column segment block structure (TupleLayout::COLUMNAR, segment file "<table>_col<column id>")
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    | pd_lsn(64) | pd_checksum(64) | pd_lower(16) | pd_upper(16) | pd_special(64) |
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    | ColumnBlockHeader{first_row(64), row_num(32), last_run_pos(16), last_value(32)} | run_1 | ...
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    run of an INTEGER column: | run_length(16) | zigzag varint of value - value of the last run |
+    run of a CHAR(n) column:  | run_length(16) | varint length | value without the padding |
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    ※ a columnar table stores every column in its own segment file, and every segment fills its
+      blocks independently, so a narrow column takes fewer blocks than a wide one. The rows are
+      lined up by row id: a block holds the rows first_row .. first_row + row_num - 1, so the
+      block headers are the directory of the segment. A scan reads only the segments of the
+      selected columns. The values are run-length and delta encoded per block. A row goes to
+      the last block of every segment, or to a new block of a segment where it does not fit.
+      pd_lower is the end of the runs.
+    ※ an insert appends the row to one segment at a time, from the last column to the first,
+      and logs each value in its own record, so it pins one block whatever the number of columns.
+*/
+
 /*
     encrypt data tuple structure
     ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
@@ -74,7 +140,7 @@ const uint64_t TABLE_NAME_SIZE  = 100;
     ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
     | TableInfoHeader{table_info_size(16), table_name(100), db_node(64), rel_node(64),
     ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
-      column_num(16)} | column_pos_1(16) | column_pos_2(16) | ...
+      column_num(16), tuple_layout(8)} | column_pos_1(16) | column_pos_2(16) | ...
     ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
                                                                   ... | column_2(z) | column_1(z) |
     ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
@@ -98,10 +164,48 @@ typedef struct HeapHeaderInfo {
 
 static const uint64_t HEAP_CONTENT_SIZE = PAGE_TABLE_SIZE - sizeof(HeapHeaderInfo);
 
+// pd_checksum is PAGE_CHECKSUM_VALID | crc32c of the block number and of the page without
+// pd_checksum. It is set when the page is written out and verified when it is read back, since
+// the storage is not trusted. A page written before checksums existed has pd_checksum 0, is
+// read without verification and gets its checksum when it is written again. Any other value
+// without PAGE_CHECKSUM_VALID fails the verification.
+static const uint64_t PAGE_CHECKSUM_VALID = 1ULL << 32;
+
+typedef enum class ChecksumVerifyMode : uint8_t {
+    OFF,    // checksums are written, but not verified
+    WARN,   // a mismatch is reported and the page is used anyway
+    ERROR,  // a mismatch is an error
+} ChecksumVerifyMode;
+
+/*
+    free space map structure (fork file "<table>_fsm")
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    | HeapHeaderInfo{..., pd_special = upper bound of the categories in this page} |
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    | category of heap block n * HEAP_CONTENT_SIZE (8) | category of the next block (8) | ...
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    ※ a block of category c has at least c * FSM_CATEGORY_SIZE free bytes. 0 means unknown or full.
+    ※ the map is not logged. a page which fails its checksum is read as an empty page, since
+      0 only makes an insert look elsewhere, and the categories are set again by the inserts.
+*/
+static const uint16_t FSM_CATEGORY_SIZE = PAGE_TABLE_SIZE / 256;
+static const char* const FSM_FORK_SUFFIX = "_fsm";
+static const char* const COLUMN_SEGMENT_SUFFIX = "_col";
+
+typedef struct ColumnBlockHeader {
+    uint64_t first_row;     // row id of the first value in the block
+    uint32_t row_num;       // values in the block
+    uint16_t last_run_pos;  // position of the last run in the page
+    int32_t last_value;     // value of the last run of an INTEGER column
+} ColumnBlockHeader;
+
+// virtual table which shows the statistics of the buffer pool, one row per relation.
+static const char* const SYS_BUFFERCACHE_TABLE = "sys_buffercache";
+
 typedef struct BufferTag {
     Oid db_node;                  // database OID
     Oid rel_node;                 // relation table OID
-    int fd;                       // file descriptor
+    int fd;                       // file descriptor cached by DiskManager
     uint64_t heap_file_block_id;  // page id in heap file (0-index)
     const char* table_ident;      // table identifier
 
@@ -121,16 +225,48 @@ typedef struct BufferId {
     uint64_t id;
 } BufferId;
 
-typedef struct DataEntry {
-    BufferTag tag;
-    BufferId buffer_id;  // hold the id of buffer_descriptor array
-    std::shared_ptr<DataEntry> data_entry = nullptr;
-} DataEntry;
+/*
+    buffer table (BufferTag -> buffer id)
+    The table is split into NUM_BUFFER_PARTITIONS partitions by the high bits of the tag hash,
+    and every partition is an open-addressed (linear probing) array of BufferTableSlot.
+    A slot only holds the hash code and the buffer id, and the full tag is compared against
+    buffer_descriptor[buffer_id].tag, so a probe touches 8 bytes per slot and never allocates.
+    Deletion uses backward shift, so there are no tombstones.
+    Every partition has its own lock. lookup needs it shared, insert and erase exclusive, and the
+    tag of a buffer in the table is only changed while holding the lock of its partition.
+*/
 
-typedef struct BufferTable {
-    std::shared_ptr<DataEntry> bucket_slots[BUCKET_SLOT_SIZE] = {nullptr};
-    uint32_t next_slot_id;
-} BufferTable;
+typedef struct BufferTableSlot {
+    uint32_t hash_code;
+    uint32_t buffer_id;  // buffer id + 1, 0 means empty slot
+} BufferTableSlot;
+
+typedef struct BufferTablePartition {
+    std::vector<BufferTableSlot> slots;  // size is power of 2
+    uint32_t entry_num = 0;
+} BufferTablePartition;
+
+struct BufferDescriptor;
+
+class BufferTable {
+   public:
+    BufferTable(uint32_t buffer_num, const struct BufferDescriptor* descriptors);
+    int64_t lookup(const BufferTag& buffer_tag, uint64_t hash) const;
+    void insert(const BufferTag& buffer_tag, uint64_t hash, BufferId buffer_id);
+    void erase(const BufferTag& buffer_tag, uint64_t hash);
+    static inline uint32_t getPartitionId(uint64_t hash) {
+        return (uint32_t)(hash >> 32) % NUM_BUFFER_PARTITIONS;
+    }
+    inline std::shared_mutex& getPartitionLock(uint64_t hash) {
+        return partition_locks[getPartitionId(hash)];
+    }
+
+   private:
+    BufferTablePartition partitions[NUM_BUFFER_PARTITIONS];
+    std::shared_mutex partition_locks[NUM_BUFFER_PARTITIONS];
+    const struct BufferDescriptor* buffer_descriptor;
+    void grow(BufferTablePartition& partition);
+};
 
 typedef enum PageFlags {
     DIRTY = 100,
@@ -150,6 +286,7 @@ typedef struct ColumnTuple {
     DataType type;
     uint16_t type_size;
     ColumnAttribute attribute;
+    uint16_t fixed_offset = 0;  // offset of the field in a TupleLayout::FIXED tuple
 
     ColumnTuple(){};
     static inline ColumnAttribute convertToColumnAttribute(IdentAttribute ident_attribute);
@@ -173,14 +310,24 @@ typedef struct ColumnTuple {
     };
 } ColumnTuple;
 
+typedef enum class TupleLayout : uint8_t {
+    VARIABLE = 0,  // field_num and field_pos in every tuple
+    FIXED    = 1,  // fields at fixed offsets, see fixed-width plain data tuple structure
+    PAX      = 2,  // fields of each column together, see PAX page structure
+    COLUMNAR = 3,  // one segment file per column, see column segment block structure
+} TupleLayout;
+
 typedef struct TableInfoHeader {
     uint16_t table_info_size;
     char table_name[TABLE_NAME_SIZE];
     uint64_t db_node;
     uint64_t rel_node;
     uint16_t column_num;
+    TupleLayout tuple_layout;  // in the former padding, so old schemas read as VARIABLE
 } TableInfoHeader;
 
+static_assert(sizeof(TableInfoHeader) == 128);
+
 typedef struct SchemaInfoHeader {
     uint64_t table_num;
     uint16_t pd_lower;
@@ -188,15 +335,79 @@ typedef struct SchemaInfoHeader {
 
 typedef struct SchemaInfo {
     SchemaInfoHeader schema_info_header;
-    uint8_t schema_info_content[SCHEMA_FILE_SIZE - sizeof(TableInfoHeader)];
+    uint8_t schema_info_content[SCHEMA_FILE_SIZE - sizeof(SchemaInfoHeader)];
 } SchemaInfo;
 
-typedef struct BufferDescriptor {
-    BufferTag tag;
-    PageFlags flags;
-    uint16_t ref_count;    // process number accesing target page
-    uint64_t usage_count;  // number of using by any process
+/*
+    state word of buffer descriptor
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    | flags(10) | usage_count(4) | ref_count(18) |
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    ※ ref_count and usage_count are changed by compare-and-swap. The flags are changed only while
+      holding BM_LOCKED, the spin lock of the descriptor header, which also makes the pinning
+      threads wait.
+    ※ BM_CHECKPOINT_NEEDED marks the buffers which were dirty when the running checkpoint took
+      its redo point. It is cleared with BM_DIRTY when the page is written by anyone.
+*/
+const uint32_t BUF_REFCOUNT_ONE     = 1;
+const uint32_t BUF_REFCOUNT_MASK    = (1U << 18) - 1;
+const uint32_t BUF_USAGECOUNT_SHIFT = 18;
+const uint32_t BUF_USAGECOUNT_ONE   = 1U << BUF_USAGECOUNT_SHIFT;
+const uint32_t BUF_USAGECOUNT_MASK  = 0xFU << BUF_USAGECOUNT_SHIFT;
+const uint32_t BM_LOCKED            = 1U << 22;
+const uint32_t BM_DIRTY             = 1U << 23;
+const uint32_t BM_VALID             = 1U << 24;  // page content is valid
+const uint32_t BM_TAG_VALID         = 1U << 25;  // tag is valid and in buffer table
+const uint32_t BM_IO_IN_PROGRESS    = 1U << 26;  // page is being read
+const uint32_t BM_CHECKPOINT_NEEDED = 1U << 27;  // must be written by the running checkpoint
+
+/*
+    statistics of the buffer pool, kept per relation (every fork file is its own relation).
+    The counters are only incremented with relaxed atomics, and a buffer keeps the pointer to
+    the statistics of its relation, so counting a hit is one fetch_add.
+*/
+typedef struct alignas(64) BufferStats {
+    std::string relation_name;
+    std::atomic<uint64_t> hits              = 0;  // page found in the pool
+    std::atomic<uint64_t> misses            = 0;  // page not in the pool
+    std::atomic<uint64_t> evictions         = 0;  // valid page replaced by another one
+    std::atomic<uint64_t> eviction_writes   = 0;  // dirty pages written to evict a victim
+    std::atomic<uint64_t> bgwriter_writes   = 0;  // dirty pages written by background writer
+    std::atomic<uint64_t> checkpoint_writes = 0;  // dirty pages written by checkpoints
+    std::atomic<uint64_t> read_bytes        = 0;
+    std::atomic<uint64_t> write_bytes       = 0;
+    std::atomic<uint64_t> checksum_failures = 0;
+} BufferStats;
+
+// snapshot of BufferStats.
+typedef struct BufferStatsRow {
+    std::string relation_name;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t eviction_writes;
+    uint64_t bgwriter_writes;
+    uint64_t checkpoint_writes;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t checksum_failures;
+} BufferStatsRow;
+
+typedef enum class FlushReason {
+    EVICTION,
+    BGWRITER,
+    CHECKPOINT,
+    SHUTDOWN,
+} FlushReason;
+
+// descriptors live in their own array apart from buffer_pool, aligned to cache lines.
+typedef struct alignas(64) BufferDescriptor {
+    BufferTag tag;                // changed under the buffer table partition lock
+    BufferStats* stats;           // statistics of the relation of tag, changed with tag
+    std::atomic<uint32_t> state;  // flags, usage_count and ref_count
     BufferId buffer_id;
+    uint64_t io_ticket;  // AsyncIo ticket of the running read while BM_IO_IN_PROGRESS
+    std::shared_mutex content_lock;  // shared to read or write out the page, exclusive to modify
 } BufferDescriptor;
 
 typedef struct BufferPage {
@@ -204,41 +415,264 @@ typedef struct BufferPage {
     uint8_t heap_content[HEAP_CONTENT_SIZE] = {0};
 } BufferPage;
 
+// a buffer page is read and written as one block of the table file.
+static_assert(sizeof(BufferPage) == PAGE_TABLE_SIZE);
+
+/*
+    readahead state of one sequential scan.
+    The scan prefetches up to window blocks ahead of the current block. The window doubles
+    every time a prefetch has to start an I/O, and shrinks by one every time the block is
+    already cached, so fully cached tables stop paying for the lookahead.
+*/
+typedef struct ReadAheadState {
+    bool started        = false;
+    uint64_t next_block = 0;  // first block which is not prefetched yet
+    uint32_t window     = 1;
+} ReadAheadState;
+
+/*
+    access strategy of a bulk read.
+    A scan of a table larger than a quarter of the buffer pool takes its victims from this small
+    ring of buffers instead of the clock sweep, as long as the ring buffer is unpinned and was
+    not used by anyone else in the meantime. So one big scan does not evict the whole pool.
+*/
+typedef struct BufferAccessStrategy {
+    std::vector<int64_t> ring;  // buffer ids, -1 until the slot gets its first buffer
+    uint32_t current = 0;
+    explicit BufferAccessStrategy(uint32_t ring_size) : ring(ring_size, -1) {}
+} BufferAccessStrategy;
+
 typedef struct Tid {
     uint64_t block;
     uint16_t offset;
 } Tid;
 
+class BufferManager;
+
+typedef enum class BufferLockMode {
+    UNLOCKED,
+    SHARED,
+    EXCLUSIVE,
+} BufferLockMode;
+
+/*
+    PageGuard holds one pin on a buffer and releases it when it goes out of scope.
+    A pinned buffer is never chosen as a victim, so the page pointer is valid until release().
+    The page content is read under lockShared() and modified under lockExclusive(), and the
+    content lock is also released by release().
+*/
+class PageGuard {
+   public:
+    PageGuard();
+    PageGuard(BufferManager* buffer_manager_arg, BufferId buffer_id_arg);
+    PageGuard(PageGuard&& other) noexcept;
+    PageGuard& operator=(PageGuard&& other) noexcept;
+    PageGuard(const PageGuard&)            = delete;
+    PageGuard& operator=(const PageGuard&) = delete;
+    ~PageGuard();
+    void release();
+    void lockShared();
+    void lockExclusive();
+    void unlock();
+    void markDirty();
+    BufferPage* getPage() const;
+    inline BufferId getBufferId() const { return buffer_id; }
+    inline bool isValid() const { return buffer_manager != nullptr; }
+
+   private:
+    BufferManager* buffer_manager;
+    BufferId buffer_id;
+    BufferLockMode lock_mode;
+};
+
+// one field of a tuple, pointing into the page. nothing is copied.
+typedef struct FieldView {
+    const ColumnTuple* column;
+    const uint8_t* data;
+    uint16_t size;
+} FieldView;
+
+/*
+    projection of a scan, resolved once per query by createProjectionPlan and used for every
+    page. field_ids are the selected fields (1-index, ascending) and columns[i] is the column of
+    field_ids[i]. "*" selects every column, and an unknown column is an error.
+*/
+typedef struct ProjectionPlan {
+    const char* table_name;
+    Oid db_node;
+    Oid rel_node;
+    int fd;
+    TupleLayout tuple_layout;
+    uint16_t tuple_size;  // size of a FIXED, PAX or COLUMNAR tuple
+    std::vector<std::shared_ptr<ColumnTuple>> column_tuple_list;  // keeps the columns alive
+    std::vector<uint16_t> field_ids;
+    std::vector<const ColumnTuple*> columns;
+    std::vector<int> segment_fds;  // segment file of columns[i], only for COLUMNAR
+} ProjectionPlan;
+
+// decoded block of a column segment, kept while a scan is in its rows.
+typedef struct ColumnBlockCursor {
+    uint64_t block_id  = UINT64_MAX;  // UINT64_MAX before the first block is read
+    uint64_t first_row = 0;
+    uint32_t row_num   = 0;
+    bool complete      = false;   // a later block existed when it was read, so no rows are missing
+    std::vector<uint8_t> values;  // the values at type_size intervals, zero padded
+} ColumnBlockCursor;
+
+/*
+    selected fields of every tuple in one page, filled by getPageTupleViews.
+    The views point into the page, which stays pinned and locked shared (or, when read from the
+    mapping, into mapped_page) until the next page is read into the same PageTupleViews or it is
+    destroyed. The vectors keep their capacity, so a scan which reuses
+    one PageTupleViews for every page allocates nothing per tuple.
+    ※ a page of a COLUMNAR table is a block of the segment of the first selected column. The
+      same rows of every selected column are copied into values from column_blocks, and no page
+      stays pinned.
+*/
+typedef struct PageTupleViews {
+    PageGuard page_guard;
+    std::unique_ptr<BufferPage> mapped_page;  // copy of the last page read from the mapping
+    std::vector<FieldView> fields;     // fields of every tuple in line pos order
+    std::vector<uint32_t> tuple_ends;  // end of the fields of each tuple
+    std::vector<uint8_t> values;       // decoded values of the rows, column by column
+    std::vector<ColumnBlockCursor> column_blocks;    // last block read of each selected segment
+    std::vector<ReadAheadState> segment_read_ahead;  // readahead of each selected segment
+
+    inline size_t getTupleNum() const { return tuple_ends.size(); }
+    inline std::span<const FieldView> getTuple(size_t tuple_id) const {
+        size_t start = tuple_id == 0 ? 0 : tuple_ends[tuple_id - 1];
+        return std::span<const FieldView>(fields.data() + start, tuple_ends[tuple_id] - start);
+    }
+    void release();
+} PageTupleViews;
+
 class BufferManager {
    public:
-    std::unordered_map<BufferTag, uint32_t, BufferTag::Hash> data_entry_hash;
+    uint32_t page_nums;  // number of pages in buffer pool, given by --buffer-pages
+    size_t buffer_pool_mapping_size;
+    BufferDescriptor* buffer_descriptor;
+    BufferPage* buffer_pool;
     BufferTable* buffer_table;
+    DiskManager* disk_manager;
+    WalManager* wal_manager;
     std::unordered_map<std::string, TableInfoHeader*> buffer_table_info;
     std::unordered_map<RelNode, std::vector<std::shared_ptr<ColumnTuple>>> column_list_map;
     SchemaInfo schema_info;
     PageFlags table_info_flags = PageFlags::INVALID;
-    BufferDescriptor buffer_descriptor[PAGE_NUMS];
-    BufferPage buffer_pool[PAGE_NUMS];
+    // one insert into a columnar table at a time (rel_node -> lock), never removed.
+    std::unordered_map<RelNode, std::unique_ptr<std::mutex>> columnar_insert_locks;
+    // protects buffer_table_info, column_list_map, columnar_insert_locks and schema_info
+    std::shared_mutex catalog_lock;
+    // shared while the records of a columnar row are logged, and exclusive while a checkpoint
+    // takes its redo point, so that the redo point never falls inside a row.
+    std::shared_mutex checkpoint_delay_lock;
+    // clock hand of the clock sweep. it never wraps, the hand is at next_victim_buffer % page_nums
+    // and has passed the whole pool next_victim_buffer / page_nums times.
+    std::atomic<uint64_t> next_victim_buffer = 0;
+    std::atomic<uint32_t> recent_alloc_count = 0;  // victims since the last bgwriter round
+    // buffers of every asynchronous read in flight (AsyncIo ticket -> buffer ids), and the
+    // condition variable notified when a read of a buffer finishes. both under buffer_io_lock.
+    std::mutex buffer_io_lock;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> inflight_buffer_io;
+    std::condition_variable buffer_io_cv;
+    // statistics of every relation (file descriptor -> statistics), never removed.
+    std::mutex stats_lock;
+    std::unordered_map<int, std::unique_ptr<BufferStats>> relation_stats;
     BufferManager();
     virtual ~BufferManager();
-    BufferId getDataEntry(BufferTag& buffer_tag);
+    PageGuard fetchPage(BufferTag& buffer_tag, BufferAccessStrategy* strategy = nullptr,
+                        bool zero_page = false);
+    bool prefetchPage(BufferTag& buffer_tag, BufferAccessStrategy* strategy = nullptr);
+    void readAhead(const BufferTag& buffer_tag, ReadAheadState* read_ahead,
+                   BufferAccessStrategy* strategy);
+    std::unique_ptr<BufferAccessStrategy> getBulkReadStrategy(uint64_t table_page_num);
+    bool readMappedPage(const BufferTag& buffer_tag, BufferPage* page_copy);
+    void pinBuffer(BufferId buffer_id, BufferAccessStrategy* strategy = nullptr);
+    void unpinBuffer(BufferId buffer_id);
+    void markBufferDirty(BufferId buffer_id);
+    std::vector<BufferStatsRow> getBufferStats();
+    void printBufferStats();
     std::pair<Oid, Oid> getTableOid(const char* table_name);
-    uint64_t getTablePageNum(const char* table_name);
-    uint64_t getTablePageSize(const char* table_name);
+    uint64_t getTablePageNum(const ProjectionPlan& plan);
     const uint8_t* getTuple(Tid tid);
-    const std::vector<
-        std::vector<std::pair<std::shared_ptr<ColumnTuple>, std::pair<uint8_t*, uint16_t>>>>
-    getPageAllTupleUserData(const char* table_name, IdentList* column_ident_list, PageId page_id);
+    std::unique_ptr<ProjectionPlan> createProjectionPlan(const char* table_name,
+                                                         IdentList* column_ident_list);
+    void getPageTupleViews(const ProjectionPlan& plan, PageId page_id, PageTupleViews* views,
+                           ReadAheadState* read_ahead     = nullptr,
+                           BufferAccessStrategy* strategy = nullptr);
     void insertOneTupleToOnlyTable(ValueList* value_list, const char* table_name);
+    void recordFreeSpace(const char* table_name, PageId page_id, uint16_t free_space);
     static void createDataFile(const char* table_name);
-    void addNewTableToBuffer(const char* table_name, IdentList* ident_list);
+    void addNewTableToBuffer(const char* table_name, IdentList* ident_list,
+                             TableStorage table_storage = HEAP_STORAGE);
     void getAllTableToCache();
     void tablePageFlush();
+    void createCheckpoint(bool immediate);
 
    private:
-    BufferId setNewBufferDescriptor(BufferTag& buffer_tag);
-    void pageFlush(uint16_t buffer_id);
-    void setPageToBufferPool(BufferTag& buffer_tag, BufferId* buffer_id);
+    // background writer state
+    std::thread bgwriter_thread;
+    std::mutex bgwriter_mutex;
+    std::condition_variable bgwriter_cv;
+    bool bgwriter_shutdown          = false;
+    uint32_t bgwriter_next_to_clean = 0;
+    uint64_t bgwriter_next_passes   = 0;
+    float bgwriter_smoothed_alloc   = 0;
+    void backgroundWriterMain();
+    uint32_t backgroundBufferSync();
+    // checkpointer state
+    std::thread checkpointer_thread;
+    std::mutex checkpointer_mutex;
+    std::condition_variable checkpointer_cv;
+    bool checkpointer_shutdown      = false;
+    std::atomic<bool> recovery_done = false;  // no checkpoint before the WAL is replayed
+    std::mutex checkpoint_lock;               // one checkpoint at a time
+    std::shared_mutex flush_lock;  // shared while writing buffers, exclusive to wait for them
+    void checkpointerMain();
+    BufferPage* allocateBufferPool(uint32_t page_num);
+    BufferStats* getRelationStats(int fd);
+    bool verifyPageChecksum(const BufferPage* page, uint64_t block_id, BufferStats* stats);
+    BufferId getDataEntry(BufferTag& buffer_tag, BufferAccessStrategy* strategy,
+                          bool zero_page = false);
+    BufferId setNewBufferDescriptor(BufferTag& buffer_tag, uint64_t hash,
+                                    BufferAccessStrategy* strategy, bool* found);
+    bool pinDirtyBufferForWrite(BufferId buffer_id, uint32_t dirty_flag = BM_DIRTY,
+                                bool wait = false);
+    uint32_t clockSweepTick();
+    BufferId getVictimBuffer(BufferAccessStrategy* strategy);
+    int64_t getBufferFromRing(BufferAccessStrategy* strategy);
+    BufferTag getFreeSpaceMapTag(const char* table_name, uint64_t fsm_block_id);
+    int64_t getPageWithFreeSpace(const char* table_name, uint16_t space_needed);
+    void loadColumnBlock(const ProjectionPlan& plan, size_t column_index, uint64_t block_id,
+                         PageTupleViews* views, bool read_ahead, BufferAccessStrategy* strategy);
+    const ColumnBlockCursor& seekColumnBlock(const ProjectionPlan& plan, size_t column_index,
+                                             uint64_t row_id, PageTupleViews* views,
+                                             bool read_ahead, BufferAccessStrategy* strategy);
+    void insertColumnarTuple(const char* table_name,
+                             const std::vector<std::shared_ptr<ColumnTuple>>& column_tuple_list,
+                             const uint8_t* tuple_ptr);
+    uint64_t appendColumnValue(const char* table_name,
+                               const std::vector<std::shared_ptr<ColumnTuple>>& column_tuple_list,
+                               size_t column_id, const uint8_t* tuple_ptr, uint64_t* row_id);
+    uint64_t getColumnSegmentRowNum(const char* table_name, size_t column_id);
+    void pageFlush(uint32_t buffer_id);
+    uint32_t flushBuffers(const std::vector<uint32_t>& buffer_ids, FlushReason reason,
+                          bool async_write = false);
+    void releaseWrittenBuffers(const std::vector<uint32_t>& buffer_ids);
+    void setPageToBufferPool(BufferTag& buffer_tag, BufferId* buffer_id, bool async_read,
+                             bool zero_page = false);
+    bool redoCreateTable(const uint8_t* table_info, uint16_t table_info_size);
+    void redoInsertRecords(const std::vector<uint8_t>& wal_records);
+    void redoBlock(const char* table_name, uint64_t block_id,
+                   const std::vector<uint8_t>& wal_records, const std::vector<size_t>& offsets);
+    void redoColumnarBlock(const char* table_name, size_t column_id, uint64_t block_id,
+                           const std::vector<uint8_t>& wal_records,
+                           const std::vector<size_t>& offsets);
+    void waitBufferIo(BufferId buffer_id);
+    void completeBufferIo(uint64_t io_ticket, std::unique_lock<std::mutex>& lock);
+    bool tryCompleteBufferIo(uint32_t buffer_id);
+    void finishBufferIo(const std::vector<uint32_t>& buffer_ids, int32_t result);
+    void terminateBufferIo(uint32_t buffer_id, uint32_t set_flags);
 };
 
 #endif
\ No newline at end of file
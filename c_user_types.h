@@ -20,6 +20,9 @@ typedef enum DataType { INT = 11, STRING = 12, NONE = 13 } DataType;
 
 typedef enum IdentAttribute { NORMAL = 1, SECRET = 2 } IdentAttribute;
 
+// storage of a new table, "create table ... using columnar" for COLUMNAR_STORAGE.
+typedef enum TableStorage { HEAP_STORAGE = 0, COLUMNAR_STORAGE = 1 } TableStorage;
+
 typedef struct IdentList NormalIdentList;
 typedef struct IdentList SecretIdentList;
 
@@ -43,6 +46,7 @@ struct QueryNode {
     struct IdentList* identList;
     struct ValueList* valueList;
     struct ExpNode* whereNode;
+    TableStorage tableStorage;
 };
 
 typedef ValueList NormalValueList;
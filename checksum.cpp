@@ -0,0 +1,106 @@
+#include "checksum.h"
+#include <string.h>
+#include <array>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+static const uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;  // reflected 0x1EDC6F41
+
+typedef uint32_t (*Crc32cFunction)(uint32_t crc, const uint8_t* data, size_t size);
+
+// table[k][b] is the crc of byte b followed by k zero bytes.
+static constexpr std::array<std::array<uint32_t, 256>, 8> makeCrc32cTable() {
+    std::array<std::array<uint32_t, 256>, 8> table = {};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        }
+        table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+        }
+    }
+    return table;
+}
+
+static constexpr std::array<std::array<uint32_t, 256>, 8> CRC32C_TABLE = makeCrc32cTable();
+
+static uint32_t crc32cSlicingBy8(uint32_t crc, const uint8_t* data, size_t size) {
+    for (; size > 0 && ((uintptr_t)data & 7) != 0; --size) {
+        crc = CRC32C_TABLE[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    // 8 bytes per step, little endian
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        word ^= crc;
+        crc = CRC32C_TABLE[7][word & 0xFF] ^ CRC32C_TABLE[6][(word >> 8) & 0xFF] ^
+              CRC32C_TABLE[5][(word >> 16) & 0xFF] ^ CRC32C_TABLE[4][(word >> 24) & 0xFF] ^
+              CRC32C_TABLE[3][(word >> 32) & 0xFF] ^ CRC32C_TABLE[2][(word >> 40) & 0xFF] ^
+              CRC32C_TABLE[1][(word >> 48) & 0xFF] ^ CRC32C_TABLE[0][word >> 56];
+    }
+    for (; size > 0; --size) {
+        crc = CRC32C_TABLE[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t crc32cSse42(uint32_t crc, const uint8_t* data,
+                                                               size_t size) {
+    for (; size > 0 && ((uintptr_t)data & 7) != 0; --size) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    uint64_t crc64 = crc;
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for (; size > 0; --size) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32cArmv8(uint32_t crc, const uint8_t* data, size_t size) {
+    for (; size > 0 && ((uintptr_t)data & 7) != 0; --size) {
+        crc = __crc32cb(crc, *data++);
+    }
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    for (; size > 0; --size) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+static Crc32cFunction selectCrc32c() {
+#if defined(__x86_64__)
+    // this runs during static initialization, possibly before the cpu model of libgcc is.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        return crc32cSse42;
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    return crc32cArmv8;
+#endif
+    return crc32cSlicingBy8;
+}
+
+static const Crc32cFunction crc32c_function = selectCrc32c();
+
+uint32_t crc32c(const void* data, size_t size, uint32_t crc) {
+    return ~crc32c_function(~crc, (const uint8_t*)data, size);
+}
@@ -0,0 +1,15 @@
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    CRC32C (Castagnoli polynomial), as used by iSCSI and ext4.
+    It is computed with the crc32 instruction of SSE4.2 when the CPU has it, with the CRC32
+    instructions of ARMv8 when the binary is built for them, and with slicing-by-8 tables
+    otherwise. crc is the result of the previous call, so data can be checksummed in pieces.
+*/
+uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0);
+
+#endif
@@ -3,41 +3,212 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include "util.h"
 
-const uint64_t PAGESIZE = 4096;
+extern std::string PROJECT_PATH;
 
-// DiskManager::DiskManager(const char* filePath) {
-//     file_path = filePath;
-//     fd        = -1;
-//     if (strlen(file_path) > 0) {
-//         fd = open(file_path, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
-//     }
+DiskManager::DiskManager(size_t page_size_arg, bool use_io_uring, bool direct_io_arg,
+                         bool mmap_reads_arg)
+    : async_io(new AsyncIo(use_io_uring)),
+      page_size(page_size_arg),
+      direct_io(direct_io_arg && !mmap_reads_arg),
+      mmap_reads(mmap_reads_arg),
+      relation_file_map(),
+      fd_relation_map() {
+    // the mapping reads through the page cache, which O_DIRECT writes would bypass.
+    if (direct_io_arg && mmap_reads_arg) {
+        printf("--direct-io is ignored with --mmap-reads.\n");
+    }
+}
 
-//     off_t offset = lseek(fd, 0, SEEK_END);
-//     file_length  = offset;
-// }
+DiskManager::~DiskManager() {
+    delete (async_io);
+    for (auto&& [mapping, mapping_size] : retired_mappings) {
+        munmap(mapping, mapping_size);
+    }
+    for (auto&& [_, relation_file] : relation_file_map) {
+        if (relation_file.mapping != nullptr) {
+            munmap(relation_file.mapping, relation_file.mapped_block_num * page_size);
+        }
+        close(relation_file.fd);
+    }
+}
 
-// void DiskManager::pageFlush(uint64_t pageId, size_t dataSize) {
-//     if (pager->pages[pageId] == NULL) {
-//         printf("Cannot flush null page.\n");
-//         exit(EXIT_FAILURE);
-//     }
+RelationFile* DiskManager::openRelation(const char* table_name, bool create) {
+    std::lock_guard<std::mutex> guard(relation_lock);
+    auto target = relation_file_map.find(table_name);
+    if (target != relation_file_map.end()) {
+        return &target->second;
+    }
 
-//     off_t off = lseek(pager->fd, PAGE_SIZE * pageId, SEEK_SET);
+    int flags = O_RDWR;
+    if (create) flags |= O_CREAT;
+    if (direct_io) flags |= O_DIRECT;
+    int fd = open((PROJECT_PATH + table_name).c_str(), flags, S_IWUSR | S_IRUSR);
+    if (fd == -1 && direct_io && errno == EINVAL) {
+        // the file system does not support O_DIRECT
+        printf("O_DIRECT is not supported, falling back to buffered I/O.\n");
+        direct_io = false;
+        fd        = open((PROJECT_PATH + table_name).c_str(), flags & ~O_DIRECT,
+                         S_IWUSR | S_IRUSR);
+    }
+    if (fd == -1) {
+        std::cout << table_name << std::endl;
+        debug_error("cannot open table file at openRelation.\n");
+    }
 
-//     if (off == -1) {
-//         printf("Seeking error.");
-//         exit(EXIT_FAILURE);
-//     }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1) {
+        debug_error("fstat error at openRelation.\n");
+    }
+    // O_DIRECT needs the offset, the length and the memory of every I/O aligned to the block
+    // size of the device. pages are PAGE_TABLE_SIZE long, and the buffer pool is mmap'd.
+    if (direct_io && (page_size % file_stat.st_blksize != 0 ||
+                      (uint64_t)sysconf(_SC_PAGESIZE) % file_stat.st_blksize != 0)) {
+        debug_error("page size is not aligned to the block size for O_DIRECT at openRelation.\n");
+    }
+    uint64_t block_num = (uint64_t)file_stat.st_size / page_size;
 
-//     ssize_t bytes = write(pager->fd, pager->pages[pageId], dataSize);
+    auto relation_entry          = relation_file_map.try_emplace(table_name, fd, block_num).first;
+    RelationFile* relation_file  = &relation_entry->second;
+    relation_file->relation_name = relation_entry->first.c_str();
+    fd_relation_map[fd]          = relation_file;
+    return relation_file;
+}
 
-//     if (bytes == -1) {
-//         printf("Writing file error.\n");
-//         exit(EXIT_FAILURE);
-//     }
-// }
+RelationFile* DiskManager::getRelation(int fd) {
+    std::lock_guard<std::mutex> guard(relation_lock);
+    auto target = fd_relation_map.find(fd);
+    if (target == fd_relation_map.end()) {
+        debug_error("unknown file descriptor at getRelation.\n");
+    }
+    return target->second;
+}
 
-// DiskManager::~DiskManager() { close(fd); }
\ No newline at end of file
+void DiskManager::readPage(int fd, uint64_t block_id, void* page) {
+    ssize_t bytes = pread(fd, page, page_size, (off_t)(block_id * page_size));
+    if (bytes != (ssize_t)page_size) {
+        debug_error("Failed to read the file at readPage.\n");
+    }
+}
+
+void DiskManager::writePage(int fd, uint64_t block_id, const void* page) {
+    writePages(fd, block_id, std::vector<const void*>{page});
+}
+
+void DiskManager::writePages(int fd, uint64_t start_block_id,
+                             const std::vector<const void*>& pages) {
+    // one pwritev for every IOV_MAX pages of consecutive blocks
+    std::vector<struct iovec> iov(std::min(pages.size(), (size_t)IOV_MAX));
+    for (size_t done = 0; done < pages.size();) {
+        size_t iov_num = std::min(pages.size() - done, (size_t)IOV_MAX);
+        for (size_t i = 0; i < iov_num; i++) {
+            iov[i].iov_base = const_cast<void*>(pages[done + i]);
+            iov[i].iov_len  = page_size;
+        }
+        ssize_t bytes =
+            pwritev(fd, iov.data(), (int)iov_num, (off_t)((start_block_id + done) * page_size));
+        if (bytes != (ssize_t)(iov_num * page_size)) {
+            debug_error("Failed to write the file at writePages.\n");
+        }
+        done += iov_num;
+    }
+    getRelation(fd)->writtenTo(start_block_id + pages.size());
+}
+
+const uint8_t* DiskManager::mapPage(int fd, uint64_t block_id) {
+    std::lock_guard<std::mutex> guard(relation_lock);
+    RelationFile* relation_file = fd_relation_map.at(fd);
+    if (block_id >= relation_file->disk_block_num) {
+        return nullptr;
+    }
+    if (block_id >= relation_file->mapped_block_num) {
+        // the file has grown since it was mapped, so map it again as a whole.
+        uint64_t disk_block_num = relation_file->disk_block_num;
+        size_t mapping_size     = disk_block_num * page_size;
+        void* mapping           = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            debug_error("Failed to map the table file at mapPage.\n");
+        }
+        if (relation_file->mapping != nullptr) {
+            retired_mappings.push_back(
+                {relation_file->mapping, relation_file->mapped_block_num * page_size});
+        }
+        relation_file->mapping          = (uint8_t*)mapping;
+        relation_file->mapped_block_num = disk_block_num;
+        if (relation_file->sequential) {
+            madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+        }
+    }
+    return relation_file->mapping + block_id * page_size;
+}
+
+void DiskManager::adviseSequential(int fd) {
+    // O_DIRECT bypasses the page cache, so there is nothing to advise.
+    std::lock_guard<std::mutex> guard(relation_lock);
+    if (direct_io) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    RelationFile* relation_file = fd_relation_map.at(fd);
+    relation_file->sequential   = true;
+    if (relation_file->mapping != nullptr) {
+        madvise(relation_file->mapping, relation_file->mapped_block_num * page_size,
+                MADV_SEQUENTIAL);
+    }
+}
+
+void DiskManager::adviseWillNeed(int fd, uint64_t start_block_id, uint64_t block_num) {
+    std::lock_guard<std::mutex> guard(relation_lock);
+    if (direct_io) return;
+    RelationFile* relation_file = fd_relation_map.at(fd);
+    if (start_block_id + block_num <= relation_file->mapped_block_num) {
+        madvise(relation_file->mapping + start_block_id * page_size, block_num * page_size,
+                MADV_WILLNEED);
+        return;
+    }
+    posix_fadvise(fd, (off_t)(start_block_id * page_size), (off_t)(block_num * page_size),
+                  POSIX_FADV_WILLNEED);
+}
+
+uint64_t DiskManager::startReadPage(int fd, uint64_t block_id, void* page) {
+    return async_io->submitRead(fd, block_id * page_size, page, page_size);
+}
+
+uint64_t DiskManager::startWritePages(int fd, uint64_t start_block_id,
+                                      const std::vector<const void*>& pages) {
+    return async_io->submitWrite(fd, start_block_id * page_size, pages, page_size);
+}
+
+void DiskManager::waitWritePages(uint64_t io_ticket, int fd, uint64_t start_block_id,
+                                 size_t page_num) {
+    // the blocks are on disk only when the write is done, as with writePages.
+    if (async_io->wait(io_ticket) != (int32_t)(page_num * page_size)) {
+        debug_error("Failed to write the file at waitWritePages.\n");
+    }
+    getRelation(fd)->writtenTo(start_block_id + page_num);
+}
+
+void DiskManager::syncRelations() {
+    // make every write so far durable. fdatasync runs outside relation_lock, since it may take
+    // long, and a relation file is never closed before the DiskManager is deleted.
+    std::vector<int> fds;
+    {
+        std::lock_guard<std::mutex> guard(relation_lock);
+        for (auto&& [fd, relation_file] : fd_relation_map) {
+            (void)(relation_file);
+            fds.push_back(fd);
+        }
+    }
+    for (int fd : fds) {
+        if (fdatasync(fd) == -1) {
+            debug_error("Failed to sync the file at syncRelations.\n");
+        }
+    }
+}
@@ -3,26 +3,76 @@
 
 #include <stdint.h>
 #include <stdio.h>
-#include "bufferManager.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "asyncIo.h"
 
-extern const uint64_t PAGESIZE;
+typedef struct RelationFile {
+    int fd;
+    const char* relation_name = nullptr;  // key of DiskManager::relation_file_map
+    std::atomic<uint64_t> disk_block_num;  // number of blocks written to the table file
+    std::atomic<uint64_t> block_num;  // number of blocks including ones only in buffer pool
+    // below are protected by DiskManager::relation_lock
+    uint8_t* mapping          = nullptr;  // read-only mapping of the table file, with mmap_reads
+    uint64_t mapped_block_num = 0;
+    bool sequential           = false;  // read sequentially, advised to the kernel
 
+    RelationFile(int fd_arg, uint64_t block_num_arg)
+        : fd(fd_arg), disk_block_num(block_num_arg), block_num(block_num_arg) {}
+    // the block counts only grow, even when writers of different blocks race.
+    static inline void growTo(std::atomic<uint64_t>& counter, uint64_t new_block_num) {
+        uint64_t old_block_num = counter.load();
+        while (old_block_num < new_block_num &&
+               !counter.compare_exchange_weak(old_block_num, new_block_num)) {
+        }
+    }
+    inline void extendTo(uint64_t new_block_num) { growTo(block_num, new_block_num); }
+    inline void writtenTo(uint64_t new_block_num) { growTo(disk_block_num, new_block_num); }
+} RelationFile;
+
+/*
+    DiskManager keeps one file descriptor per table file for the lifetime of the process,
+    and every page I/O is a positional pread/pwrite on it (no open/seek/close per page).
+    The size of each table is tracked in RelationFile, so that it is never asked to the kernel
+    after the first open.
+    With direct_io, table files are opened with O_DIRECT, so pages are cached only once, in the
+    buffer pool. Every I/O is then a whole page at a page-aligned offset, from a buffer pool page
+    aligned to the OS page size.
+    With mmap_reads, pages on disk can also be read straight from a shared read-only mapping of
+    the table file. The mapping is replaced when the file has grown past it, and old mappings are
+    kept until the process ends, so that a page being read never disappears.
+*/
 class DiskManager {
    public:
-    DiskManager();
+    AsyncIo* async_io;
+    DiskManager(size_t page_size_arg, bool use_io_uring, bool direct_io_arg, bool mmap_reads_arg);
     virtual ~DiskManager();
-    void pageFlush(BufferManager* buffer_manager, int buffer_id, uint64_t pageId, size_t dataSize);
-};
+    RelationFile* openRelation(const char* table_name, bool create);
+    RelationFile* getRelation(int fd);
+    void readPage(int fd, uint64_t block_id, void* page);
+    void writePage(int fd, uint64_t block_id, const void* page);
+    void writePages(int fd, uint64_t start_block_id, const std::vector<const void*>& pages);
+    const uint8_t* mapPage(int fd, uint64_t block_id);
+    inline bool isMmapReads() const { return mmap_reads; }
+    void adviseSequential(int fd);
+    void adviseWillNeed(int fd, uint64_t start_block_id, uint64_t block_num);
+    uint64_t startReadPage(int fd, uint64_t block_id, void* page);
+    uint64_t startWritePages(int fd, uint64_t start_block_id,
+                             const std::vector<const void*>& pages);
+    void waitWritePages(uint64_t io_ticket, int fd, uint64_t start_block_id, size_t page_num);
+    void syncRelations();
 
-// typedef struct DiskManager {
-//     FILE* heap_file;
-//     uint8_t page_id;
-// } DiskManager;
-
-// DiskManager* new_disk(FILE* heap_file);
-// DiskManager* open_disk(const char* path);
-// char* read_page_data(DiskManager* diskmgr);
-// void write_page_data(DiskManager* diskmgr);
-// void allocate_page(DiskManager* diskmgr);
+   private:
+    size_t page_size;
+    bool direct_io;
+    bool mmap_reads;
+    std::vector<std::pair<uint8_t*, size_t>> retired_mappings;
+    std::mutex relation_lock;  // protects the maps below
+    std::unordered_map<std::string, RelationFile> relation_file_map;
+    std::unordered_map<int, RelationFile*> fd_relation_map;
+};
 
-#endif
\ No newline at end of file
+#endif
@@ -1,5 +1,6 @@
 #include <pwd.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cstdio>
@@ -17,6 +18,103 @@ bool PARSE_DEBUG;
 bool PRODUCTION;
 uint8_t TID;
 bool NO_STDOUT;
+uint32_t BUFFER_POOL_PAGES;
+bool HUGE_PAGES;
+uint32_t BGWRITER_DELAY_MS     = 200;
+uint32_t BGWRITER_LRU_MAXPAGES = 100;
+float BGWRITER_LRU_MULTIPLIER  = 2.0;
+uint32_t CHECKPOINT_TIMEOUT_S      = 300;  // 0 disables the checkpointer
+float CHECKPOINT_COMPLETION_TARGET = 0.9;
+uint32_t CHECKPOINT_WAL_SIZE_MB    = 64;
+bool USE_IO_URING;
+bool DIRECT_IO;
+bool MMAP_READS;
+bool PARALLEL;
+bool BUFFER_STATS;
+ChecksumVerifyMode CHECKSUM_VERIFY = ChecksumVerifyMode::ERROR;
+bool PAX_PAGES;
+bool FIXED_TUPLES;
+std::string SCRIPT_PATH;  // run the queries of this file instead of the transactions
+bool IMMEDIATE_EXIT;      // leave without a shutdown checkpoint, as if the process crashed
+extern std::string PROJECT_PATH;
+
+static void runTransaction1(QueryProcessRun* query_process_run) {
+    auto start = std::chrono::system_clock::now();
+    // transaction_id: 1
+    {
+        // create
+        {
+            std::string query = "create table USER (id integer, name char(100));";
+            std::cout << "Query " << query << std::endl;
+            query_process_run->run(query);
+        }
+        // insert
+        {
+            int insert_num = 10;
+            for (int i = 0; i < insert_num; ++i) {
+                std::string query = "insert into USER (id, name) values (" + std::to_string(i) +
+                                    ",'nagatomi-san!" + std::to_string(i) + "');";
+                if (i == 0 || i + 1 == insert_num) {
+                    std::cout << "Query " << i + 1 << ": " << query << std::endl;
+                } else if (i == 1) {
+                    std::cout << "...\n";
+                }
+                query_process_run->run(query);
+            }
+        }
+        // select
+        {
+            std::string query = "select (id, name) from USER;";
+            std::cout << "Query " << query << std::endl;
+            query_process_run->run(query);
+        }
+    }
+    auto end = std::chrono::system_clock::now();
+    double process_time =
+        std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    std::cout << "PROCESS(TID: 1) TIME: " << process_time << std::endl;
+}
+
+static void runTransaction2(QueryProcessRun* query_process_run) {
+    auto start = std::chrono::system_clock::now();
+    // transaction_id: 2
+    {
+        // create
+        {
+            std::string query =
+                "create table STUDENT (id integer, name char(100), university char(50), club "
+                "char(50));";
+            printf("Query %s\n", query.c_str());
+            query_process_run->run(query);
+        }
+        // insert
+        {
+            int insert_num = 1000;
+            for (int i = 0; i < insert_num; ++i) {
+                std::string query =
+                    "insert into STUDENT (id, name, university, club) values (" +
+                    std::to_string(i) + ",'hamada_masahiro!" + std::to_string(i) +
+                    "', 'NAIST', 'soccer" + std::to_string(i + 1) + "');";
+                if (i == 0 || i + 1 == insert_num) {
+                    printf("Query %d: %s\n", i + 1, query.c_str());
+                } else if (i == 1) {
+                    printf("...\n");
+                }
+                query_process_run->run(query);
+            }
+        }
+        // select
+        {
+            std::string query = "select (id, name, university, club) from STUDENT;";
+            printf("Query %s\n", query.c_str());
+            query_process_run->run(query);
+        }
+    }
+    auto end = std::chrono::system_clock::now();
+    double process_time =
+        std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    std::cout << "PROCESS(TID: 2) TIME: " << process_time << std::endl;
+}
 
 /* Application entry */
 int main(int argc, char* argv[]) {
@@ -31,6 +129,45 @@ int main(int argc, char* argv[]) {
         else if (!std::strcmp(argv[i], "--tid-2"))
             TID = 2;
         NO_STDOUT |= !std::strcmp(argv[i], "--no-stdout");
+        if (!std::strncmp(argv[i], "--buffer-pages=", strlen("--buffer-pages=")))
+            BUFFER_POOL_PAGES = (uint32_t)std::stoul(argv[i] + strlen("--buffer-pages="));
+        HUGE_PAGES |= !std::strcmp(argv[i], "--huge-pages");
+        if (!std::strncmp(argv[i], "--bgwriter-delay=", strlen("--bgwriter-delay=")))
+            BGWRITER_DELAY_MS = (uint32_t)std::stoul(argv[i] + strlen("--bgwriter-delay="));
+        if (!std::strncmp(argv[i], "--bgwriter-maxpages=", strlen("--bgwriter-maxpages=")))
+            BGWRITER_LRU_MAXPAGES =
+                (uint32_t)std::stoul(argv[i] + strlen("--bgwriter-maxpages="));
+        if (!std::strncmp(argv[i], "--bgwriter-multiplier=", strlen("--bgwriter-multiplier=")))
+            BGWRITER_LRU_MULTIPLIER = std::stof(argv[i] + strlen("--bgwriter-multiplier="));
+        if (!std::strncmp(argv[i], "--checkpoint-timeout=", strlen("--checkpoint-timeout=")))
+            CHECKPOINT_TIMEOUT_S = (uint32_t)std::stoul(argv[i] + strlen("--checkpoint-timeout="));
+        if (!std::strncmp(argv[i], "--checkpoint-completion-target=",
+                          strlen("--checkpoint-completion-target=")))
+            CHECKPOINT_COMPLETION_TARGET = std::clamp(
+                std::stof(argv[i] + strlen("--checkpoint-completion-target=")), 0.1f, 1.0f);
+        if (!std::strncmp(argv[i], "--checkpoint-wal-size=", strlen("--checkpoint-wal-size=")))
+            CHECKPOINT_WAL_SIZE_MB = std::max(
+                1u, (uint32_t)std::stoul(argv[i] + strlen("--checkpoint-wal-size=")));
+        USE_IO_URING |= !std::strcmp(argv[i], "--io-uring");
+        DIRECT_IO |= !std::strcmp(argv[i], "--direct-io");
+        MMAP_READS |= !std::strcmp(argv[i], "--mmap-reads");
+        PARALLEL |= !std::strcmp(argv[i], "--parallel");
+        BUFFER_STATS |= !std::strcmp(argv[i], "--buffer-stats");
+        if (!std::strcmp(argv[i], "--checksum-verify=off"))
+            CHECKSUM_VERIFY = ChecksumVerifyMode::OFF;
+        else if (!std::strcmp(argv[i], "--checksum-verify=warn"))
+            CHECKSUM_VERIFY = ChecksumVerifyMode::WARN;
+        else if (!std::strcmp(argv[i], "--checksum-verify=error"))
+            CHECKSUM_VERIFY = ChecksumVerifyMode::ERROR;
+        PAX_PAGES |= !std::strcmp(argv[i], "--pax-pages");
+        FIXED_TUPLES |= !std::strcmp(argv[i], "--fixed-tuples");
+        if (!std::strncmp(argv[i], "--data-dir=", strlen("--data-dir="))) {
+            PROJECT_PATH = std::string(argv[i] + strlen("--data-dir="));
+            if (!PROJECT_PATH.ends_with('/')) PROJECT_PATH += '/';
+        }
+        if (!std::strncmp(argv[i], "--script=", strlen("--script=")))
+            SCRIPT_PATH = std::string(argv[i] + strlen("--script="));
+        IMMEDIATE_EXIT |= !std::strcmp(argv[i], "--immediate-exit");
     }
 
     std::unique_ptr<QueryProcessRun> query_process_run = std::make_unique<QueryProcessRun>();
@@ -57,85 +194,39 @@ int main(int argc, char* argv[]) {
     //     }
     // }
 
-    if (TID == 1) {
-        auto start = std::chrono::system_clock::now();
-        // transaction_id: 1
-        {
-            // create
-            {
-                std::string query = "create table USER (id integer, name char(100));";
-                std::cout << "Query " << query << std::endl;
-                query_process_run->run(query);
-            }
-            // insert
-            {
-                int insert_num = 10;
-                for (int i = 0; i < insert_num; ++i) {
-                    std::string query = "insert into USER (id, name) values (" + std::to_string(i) +
-                                        ",'nagatomi-san!" + std::to_string(i) + "');";
-                    if (i == 0 || i + 1 == insert_num) {
-                        std::cout << "Query " << i + 1 << ": " << query << std::endl;
-                    } else if (i == 1) {
-                        std::cout << "...\n";
-                    }
-                    query_process_run->run(query);
-                }
-            }
-            // select
-            {
-                std::string query = "select (id, name) from USER;";
-                std::cout << "Query " << query << std::endl;
-                query_process_run->run(query);
-            }
+    if (!SCRIPT_PATH.empty()) {
+        // one query per line. empty lines and lines starting with "--" are skipped.
+        std::ifstream script(SCRIPT_PATH);
+        if (!script) {
+            std::cout << "cannot open script " << SCRIPT_PATH << ".\n";
+            return EXIT_FAILURE;
         }
-        auto end = std::chrono::system_clock::now();
-        double process_time =
-            std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-        std::cout << "PROCESS(TID: 1) TIME: " << process_time << std::endl;
-    } else if (TID == 2) {
-        auto start = std::chrono::system_clock::now();
-        // transaction_id: 2
-        {
-            // create
-            {
-                std::string query =
-                    "create table STUDENT (id integer, name char(100), university char(50), club "
-                    "char(50));";
-                printf("Query %s\n", query.c_str());
-                query_process_run->run(query);
-            }
-            // insert
-            {
-                int insert_num = 1000;
-                for (int i = 0; i < insert_num; ++i) {
-                    std::string query =
-                        "insert into STUDENT (id, name, university, club) values (" +
-                        std::to_string(i) + ",'hamada_masahiro!" + std::to_string(i) +
-                        "', 'NAIST', 'soccer" + std::to_string(i + 1) + "');";
-                    if (i == 0 || i + 1 == insert_num) {
-                        printf("Query %d: %s\n", i + 1, query.c_str());
-                    } else if (i == 1) {
-                        printf("...\n");
-                    }
-                    query_process_run->run(query);
-                }
-            }
-            // select
-            {
-                std::string query = "select (id, name, university, club) from STUDENT;";
-                printf("Query %s\n", query.c_str());
-                query_process_run->run(query);
-            }
+        std::string query;
+        while (std::getline(script, query)) {
+            if (query.empty() || query.starts_with("--")) continue;
+            if (query_process_run->run(query) == QUERY_PROCESS_RESULT::EXIT) break;
         }
-        auto end = std::chrono::system_clock::now();
-        double process_time =
-            std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-        std::cout << "PROCESS(TID: 2) TIME: " << process_time << std::endl;
+    } else if (PARALLEL) {
+        // both transactions share one buffer pool.
+        query_process_run->loadTables();
+        std::thread transaction1(runTransaction1, query_process_run.get());
+        std::thread transaction2(runTransaction2, query_process_run.get());
+        transaction1.join();
+        transaction2.join();
+    } else if (TID == 1) {
+        runTransaction1(query_process_run.get());
+    } else if (TID == 2) {
+        runTransaction2(query_process_run.get());
     }
 
 query_loop_end:
 
     std::cout << "query process end.\n";
+    if (IMMEDIATE_EXIT) {
+        // every commit is in the WAL, and the buffers are dropped, so the next start recovers.
+        std::cout.flush();
+        _exit(EXIT_SUCCESS);
+    }
 
     return 0;
 }
@@ -118,6 +118,15 @@ QueryNode* Parser::QueryParser::stmParse() {
             tokenTypeAssert(TokenType::TABLE);
             query_node->tableName = getTableName();
             query_node->identList = definitionTableColumnParse();
+            // "using" is an identifier everywhere else, so that it can still name a column.
+            if (isTokenType(TokenType::IDENT) && currentToken()->ident.value() == "using") {
+                tokenIteratorInc();
+                Token* token = nextToken();
+                if (!token->ident.has_value() || token->ident.value() != "columnar") {
+                    debug_error("unknown table storage at stmParse.\n");
+                }
+                query_node->tableStorage = TableStorage::COLUMNAR_STORAGE;
+            }
             break;
         case TokenType::INSERT:
             query_node->queryType = QueryType::INSERT;
@@ -206,7 +215,7 @@ IdentList* Parser::QueryParser::columnParse() {
                 Token* token = nextToken();
                 assert(token->ident.has_value());
                 tail_ident->data_type = NONE;
-                tail_ident->ident     = (char*)calloc(1, token->ident.value().size());
+                tail_ident->ident     = (char*)calloc(1, token->ident.value().size() + 1);
                 std::char_traits<char>::copy(tail_ident->ident, token->ident.value().c_str(),
                                              token->ident.value().size());
                 if (isTokenTypeInc(TokenType::RBRACE)) {
@@ -254,7 +263,8 @@ IdentList* Parser::QueryParser::definitionTableColumnParse() {
                 Token* token = nextToken();
                 // ident name
                 assert(token->ident.has_value());
-                tailIdent->ident = (char*)calloc(1, sizeof(char) * token->ident.value().size());
+                tailIdent->ident =
+                    (char*)calloc(1, sizeof(char) * (token->ident.value().size() + 1));
                 std::char_traits<char>::copy(tailIdent->ident, token->ident.value().c_str(),
                                              token->ident.value().size());
                 // ident type
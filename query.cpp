@@ -3,11 +3,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <cassert>
+#include <mutex>
 #include "bufferManager.h"
 #include "util.h"
 
 extern bool NO_STDOUT;
 
+// concurrent queries print whole result sets, not interleaved lines.
+static std::mutex output_lock;
+
+// counter columns of sys_buffercache besides "relation".
+static const std::pair<const char*, uint64_t BufferStatsRow::*> BUFFERCACHE_COUNTER_COLUMNS[] = {
+    {"hits", &BufferStatsRow::hits},
+    {"misses", &BufferStatsRow::misses},
+    {"evictions", &BufferStatsRow::evictions},
+    {"eviction_writes", &BufferStatsRow::eviction_writes},
+    {"bgwriter_writes", &BufferStatsRow::bgwriter_writes},
+    {"checkpoint_writes", &BufferStatsRow::checkpoint_writes},
+    {"read_bytes", &BufferStatsRow::read_bytes},
+    {"write_bytes", &BufferStatsRow::write_bytes},
+    {"checksum_failures", &BufferStatsRow::checksum_failures},
+};
+
 EXIT_PROCESS continue_or_end(QueryType qtype) {
     switch (qtype) {
         case SELECT:
@@ -30,63 +47,111 @@ QueryExecutor::QueryExecutor() : buffer_manager(new BufferManager()) {}
 
 QueryExecutor::~QueryExecutor() { delete (buffer_manager); }
 
-std::vector<std::vector<std::vector<FieldData*>>> QueryExecutor::selectSecScanExec(
-    QueryNode* query_node) {
+void QueryExecutor::selectSecScanExec(QueryNode* query_node) {
     assert(query_node->queryType == QueryType::SELECT);
-    uint64_t table_page_num = buffer_manager->getTablePageNum(query_node->tableName);
-    std::vector<std::vector<std::vector<FieldData*>>> all_page_data_list = {};
+    // the columns are resolved once, before any page is read.
+    std::unique_ptr<ProjectionPlan> projection_plan =
+        buffer_manager->createProjectionPlan(query_node->tableName, query_node->identList);
+    uint64_t table_page_num   = buffer_manager->getTablePageNum(*projection_plan);
+    ReadAheadState read_ahead = ReadAheadState{};
+    // a large table is scanned through a small ring, so that it does not evict the whole pool.
+    std::unique_ptr<BufferAccessStrategy> strategy =
+        buffer_manager->getBulkReadStrategy(table_page_num);
+    // every page is printed while it is pinned, straight from the page. the output lock is
+    // taken before the first page, so no page is pinned while waiting for it.
+    std::unique_lock<std::mutex> output_guard(output_lock, std::defer_lock);
+    if (!NO_STDOUT) {
+        output_guard.lock();
+    }
+    PageTupleViews page_tuple_views;
     // operate every page
     for (PageId i = 0; i < table_page_num; ++i) {
-        auto page_all_tuple_user_data = buffer_manager->getPageAllTupleUserData(
-            query_node->tableName, query_node->identList, i);
-        IdentList* ident                               = query_node->identList;
-        std::vector<std::vector<FieldData*>> page_data = {};
+        buffer_manager->getPageTupleViews(*projection_plan, i, &page_tuple_views, &read_ahead,
+                                          strategy.get());
+        if (NO_STDOUT) {
+            continue;
+        }
+        std::cout << "page: " << i << std::endl;
         // operate every tuple
-        for (int j = 0; (__SIZE_TYPE__)j < page_all_tuple_user_data.size(); ++j) {
-            auto select_tuple_user_data = page_all_tuple_user_data[j];
-            // operate every user data
-            std::vector<FieldData*> tuple_data = {};
-            for (int k = 0; (__SIZE_TYPE__)k < select_tuple_user_data.size(); k++) {
-                auto target_column_and_data = select_tuple_user_data[k];
-                auto target_column          = target_column_and_data.first;
-                auto target_data            = target_column_and_data.second.first;
-                auto target_data_size       = target_column_and_data.second.second;
-                auto field_data = new FieldData(target_column->column_ident, target_column->type,
-                                                target_data_size, target_data);
-                tuple_data.push_back(field_data);
+        for (size_t j = 0; j < page_tuple_views.getTupleNum(); ++j) {
+            std::cout << "record " << j << ": ";
+            std::span<const FieldView> tuple_data = page_tuple_views.getTuple(j);
+            for (size_t k = 0; k < tuple_data.size(); ++k) {
+                const FieldView& field = tuple_data[k];
+                std::cout << field.column->column_ident << ": ";
+                switch (field.column->type) {
+                    case DataType::INT: {
+                        int value;
+                        memcpy(&value, field.data, sizeof(int));
+                        std::cout << value;
+                        break;
+                    }
+                    case DataType::STRING:
+                        // a CHAR(n) field of a fixed-width tuple is padded with zeros.
+                        std::cout.write((const char*)field.data,
+                                        strnlen((const char*)field.data, field.size));
+                        break;
+                    default:
+                        debug_error("selectSecScanExec undefined DataType error-2.\n");
+                        break;
+                }
+                if (k + 1 < tuple_data.size()) std::cout << ',';
             }
-            page_data.push_back(tuple_data);
+            std::cout << std::endl;
         }
-        all_page_data_list.push_back(page_data);
     }
-    if (!NO_STDOUT) {
-        for (int i = 0; (__SIZE_TYPE__)i < all_page_data_list.size(); ++i) {
-            std::cout << "page: " << i << std::endl;
-            auto page_data = all_page_data_list[i];
-            for (int j = 0; (__SIZE_TYPE__)j < page_data.size(); ++j) {
-                std::cout << "record " << j << ": ";
-                auto tuple_data = page_data[j];
-                for (int k = 0; (__SIZE_TYPE__)k < tuple_data.size(); ++k) {
-                    switch (tuple_data[k]->data_type) {
-                        case DataType::INT:
-                            std::cout << tuple_data[k]->field_name << ": "
-                                      << *(int*)tuple_data[k]->data;
-                            break;
-                        case DataType::STRING:
-                            std::cout << tuple_data[k]->field_name << ": "
-                                      << (char*)tuple_data[k]->data;
-                            break;
-                        default:
-                            debug_error("selectSecScanExec undefined DataType error-2.\n");
-                            break;
+}
+
+void QueryExecutor::selectBufferCacheExec(QueryNode* query_node) {
+    assert(query_node->queryType == QueryType::SELECT);
+    // the columns are resolved against the schema of sys_buffercache before anything is read.
+    // "*" selects every column, and an unknown column is an error.
+    std::vector<const char*> columns;
+    for (IdentList* ident = query_node->identList; ident != NULL; ident = ident->next) {
+        if (!strcmp(ident->ident, "*")) {
+            columns.push_back("relation");
+            for (auto&& [column_name, counter] : BUFFERCACHE_COUNTER_COLUMNS) {
+                columns.push_back(column_name);
+            }
+            continue;
+        }
+        bool found = !strcmp(ident->ident, "relation");
+        for (auto&& [column_name, counter] : BUFFERCACHE_COUNTER_COLUMNS) {
+            found |= !strcmp(ident->ident, column_name);
+        }
+        if (!found) {
+            debug_error("unknown column " + std::string(ident->ident) +
+                        " at selectBufferCacheExec.\n");
+        }
+        columns.push_back(ident->ident);
+    }
+
+    std::vector<BufferStatsRow> stats_rows = buffer_manager->getBufferStats();
+    if (NO_STDOUT) {
+        return;
+    }
+    // printed in the same form as a table scan. the counters do not fit in INT (32 bit), so
+    // they are printed as strings.
+    std::lock_guard<std::mutex> output_guard(output_lock);
+    std::cout << "page: 0" << std::endl;
+    for (int j = 0; (__SIZE_TYPE__)j < stats_rows.size(); ++j) {
+        std::cout << "record " << j << ": ";
+        for (size_t k = 0; k < columns.size(); k++) {
+            std::string value;
+            if (!strcmp(columns[k], "relation")) {
+                value = stats_rows[j].relation_name;
+            } else {
+                for (auto&& [column_name, counter] : BUFFERCACHE_COUNTER_COLUMNS) {
+                    if (!strcmp(columns[k], column_name)) {
+                        value = std::to_string(stats_rows[j].*counter);
                     }
-                    if ((__SIZE_TYPE__)k + 1 < tuple_data.size()) std::cout << ',';
                 }
-                std::cout << std::endl;
             }
+            if (k > 0) std::cout << ',';
+            std::cout << columns[k] << ": " << value;
         }
+        std::cout << std::endl;
     }
-    return all_page_data_list;
 }
 
 void QueryExecutor::insertToOnlyTableExec(QueryNode* query_node) {
@@ -96,7 +161,8 @@ void QueryExecutor::insertToOnlyTableExec(QueryNode* query_node) {
 
 void QueryExecutor::createNewTable(QueryNode* query_node) {
     assert(query_node->queryType == QueryType::CREATE);
-    buffer_manager->addNewTableToBuffer(query_node->tableName, query_node->identList);
+    buffer_manager->addNewTableToBuffer(query_node->tableName, query_node->identList,
+                                        query_node->tableStorage);
 }
 
 void QueryExecutor::getAllTable() { buffer_manager->getAllTableToCache(); }
@@ -105,7 +171,11 @@ bool QueryExecutor::queryExec(QueryNode* query_node) {
     bool exit = false;
     switch (query_node->queryType) {
         case QueryType::SELECT:
-            selectSecScanExec(query_node);
+            if (!strcmp(query_node->tableName, SYS_BUFFERCACHE_TABLE)) {
+                selectBufferCacheExec(query_node);
+            } else {
+                selectSecScanExec(query_node);
+            }
             break;
         case QueryType::INSERT:
             insertToOnlyTableExec(query_node);
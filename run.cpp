@@ -9,11 +9,16 @@ QueryProcessRun::QueryProcessRun() : query_executor(new QueryExecutor()) {}
 
 QueryProcessRun::~QueryProcessRun() { delete (query_executor); }
 
-QUERY_PROCESS_RESULT QueryProcessRun::run(std::string query_str) {
+// must be called before run() is used from several threads.
+void QueryProcessRun::loadTables() {
     if (!table_load_flags) {
         query_executor->getAllTable();
         table_load_flags = true;
     }
+}
+
+QUERY_PROCESS_RESULT QueryProcessRun::run(std::string query_str) {
+    loadTables();
     Parser::QueryParser query_parser = Parser::QueryParser(query_str);
     query_parser.parse();
     if (PARSE_DEBUG) {
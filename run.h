@@ -12,6 +12,7 @@ class QueryProcessRun {
     QueryProcessRun();
     ~QueryProcessRun();
     QUERY_PROCESS_RESULT run(std::string query_str);
+    void loadTables();
     bool table_load_flags = false;
 };
 
@@ -0,0 +1,168 @@
+#!/bin/bash
+# scripted checks of the app, run by "make check". every check runs the app with --script
+# against its own data directory and compares the records which the selects print.
+set -u -o pipefail
+
+APP="$(cd "$(dirname "$0")/.." && pwd)/app"
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+FAILED=0
+
+# records of the selects without the record numbers, sorted.
+records() { grep '^record' | sed 's/^record [0-9]*: //' | sort; }
+
+# expected_rows <first> <last>: the records of the rows which load_script inserts.
+expected_rows() {
+    seq "$1" "$2" | awk '{ printf "id: %d,name: name%d,score: %d\n", $1, $1, $1 % 7 }' | sort
+}
+
+# load_script <table> <first> <last> [storage clause]: creates the table if a clause is given.
+load_script() {
+    if [ $# -ge 4 ]; then
+        echo "create table $1 (id integer, name char(20), score integer)$4;"
+    fi
+    seq "$2" "$3" | awk -v t="$1" -v q="'" '{
+        printf "insert into %s (id, name, score) values (%d, %sname%d%s, %d);\n",
+               t, $1, q, $1, q, $1 % 7
+    }'
+}
+
+# check <name> <function> [arguments]: runs one check in a fresh data directory.
+check() {
+    local name=$1
+    shift
+    DATA="$WORK/$name"
+    mkdir -p "$DATA"
+    if "$@" > "$WORK/$name.log" 2>&1; then
+        echo "ok      $name"
+    else
+        echo "FAILED  $name"
+        tail -n 20 "$WORK/$name.log"
+        FAILED=1
+    fi
+}
+
+# crash_recovery <storage clause> [app flags]: the process leaves without writing its buffers
+# after the inserts, and the next start has to replay them from the WAL.
+crash_recovery() {
+    local storage=$1
+    shift
+    load_script T 1 2000 "$storage" > "$WORK/load.sql"
+    "$APP" --data-dir="$DATA" --script="$WORK/load.sql" --immediate-exit "$@" || return 1
+    # more rows after the recovery, then a clean shutdown and one more start.
+    load_script T 2001 2500 > "$WORK/more.sql"
+    "$APP" --data-dir="$DATA" --script="$WORK/more.sql" "$@" || return 1
+    echo "select (id, name, score) from T;" > "$WORK/select.sql"
+    "$APP" --data-dir="$DATA" --script="$WORK/select.sql" "$@" | records > "$WORK/actual"
+    expected_rows 1 2500 | diff -q - "$WORK/actual" > /dev/null
+}
+
+# buffercache: a table is scanned twice by a fresh process whose pool holds all of it. then
+# sys_buffercache has a row for the table and the total, and every page was read exactly once.
+buffercache() {
+    load_script T 1 2500 "" > "$WORK/load.sql"
+    "$APP" --data-dir="$DATA" --script="$WORK/load.sql" > /dev/null || return 1
+    local pages=$(($(stat -c %s "$DATA/T") / 8192))
+    printf 'select (id) from T;\nselect (id) from T;\nselect * from sys_buffercache;\n' \
+        > "$WORK/stats.sql"
+    "$APP" --data-dir="$DATA" --script="$WORK/stats.sql" | grep '^record [0-9]*: relation' |
+        awk -v pages="$pages" '
+            {
+                sub(/^record [0-9]+: /, "")
+                n = split($0, fields, ",")
+                columns = ""
+                for (i = 1; i <= n; i++) {
+                    split(fields[i], key_value, ": ")
+                    columns = columns key_value[1] " "
+                    value[key_value[1]] = key_value[2]
+                }
+                if (columns != "relation hits misses evictions eviction_writes " \
+                               "bgwriter_writes checkpoint_writes read_bytes write_bytes " \
+                               "checksum_failures ") bad = 1
+                if (value["misses"] != pages || value["read_bytes"] != pages * 8192) bad = 1
+                if (value["hits"] < pages || value["hits"] > 2 * pages) bad = 1
+                if (value["evictions"] != 0 || value["write_bytes"] != 0) bad = 1
+                if (value["checksum_failures"] != 0) bad = 1
+                relations = relations value["relation"] " "
+            }
+            END { exit bad || relations != "T total " }' || return 1
+    # the selected columns in the order they are given, and an unknown column is an error.
+    printf 'select (id) from T;\nselect (misses, relation) from sys_buffercache;\n' \
+        > "$WORK/columns.sql"
+    "$APP" --data-dir="$DATA" --script="$WORK/columns.sql" | grep '^record [0-9]*: misses' |
+        records > "$WORK/actual"
+    printf 'misses: %d,relation: T\nmisses: %d,relation: total\n' "$pages" "$pages" |
+        diff -q - "$WORK/actual" > /dev/null || return 1
+    echo "select (bogus) from sys_buffercache;" > "$WORK/bogus.sql"
+    ! "$APP" --data-dir="$DATA" --script="$WORK/bogus.sql" > /dev/null
+}
+
+# poke <file> <offset> <printf format>: overwrites bytes of a table file.
+poke() { printf "$3" | dd of="$1" bs=1 seek="$2" conv=notrunc status=none; }
+
+# checksums: a page written before checksums existed (pd_checksum 0) is read without
+# verification. a damaged page stops the scan by default, is reported and used with
+# --checksum-verify=warn, and is not verified with --checksum-verify=off.
+checksums() {
+    load_script T 1 2500 "" > "$WORK/load.sql"
+    "$APP" --data-dir="$DATA" --script="$WORK/load.sql" > /dev/null || return 1
+    echo "select (id, name, score) from T;" > "$WORK/select.sql"
+    # pd_checksum is the second 8 bytes of a page.
+    poke "$DATA/T" 8 '\0\0\0\0\0\0\0\0'
+    "$APP" --data-dir="$DATA" --script="$WORK/select.sql" | records > "$WORK/actual" || return 1
+    expected_rows 1 2500 | diff -q - "$WORK/actual" > /dev/null || return 1
+    # pd_lsn of block 1, which the scan does not look at otherwise.
+    poke "$DATA/T" 8192 '\377'
+    local mismatch="page checksum mismatch in block 1 of T"
+    ! "$APP" --data-dir="$DATA" --script="$WORK/select.sql" > "$WORK/error" || return 1
+    grep -q "$mismatch" "$WORK/error" || return 1
+    "$APP" --data-dir="$DATA" --script="$WORK/select.sql" --checksum-verify=warn \
+        > "$WORK/warn" || return 1
+    grep -q "$mismatch" "$WORK/warn" || return 1
+    records < "$WORK/warn" | diff -q - "$WORK/actual" > /dev/null || return 1
+    "$APP" --data-dir="$DATA" --script="$WORK/select.sql" --checksum-verify=off \
+        > "$WORK/off" || return 1
+    ! grep -q "mismatch" "$WORK/off"
+}
+
+# parallel: the two built-in transactions of --parallel share a pool much smaller than
+# STUDENT, so their pins, evictions and writes race. each select prints every row of its
+# table, and a fresh process reads the same rows back from disk.
+parallel() {
+    {
+        seq 0 9 | awk '{ printf "id: %d,name: nagatomi-san!%d\n", $1, $1 }'
+        seq 0 999 | awk '{
+            printf "id: %d,name: hamada_masahiro!%d,university: NAIST,club: soccer%d\n",
+                   $1, $1, $1 + 1
+        }'
+    } | sort > "$WORK/expected"
+    "$APP" --data-dir="$DATA" --parallel --buffer-pages=16 | records > "$WORK/actual" ||
+        return 1
+    diff -q "$WORK/expected" "$WORK/actual" > /dev/null || return 1
+    printf 'select (id, name) from USER;\nselect (id, name, university, club) from STUDENT;\n' \
+        > "$WORK/select.sql"
+    "$APP" --data-dir="$DATA" --script="$WORK/select.sql" | records > "$WORK/actual"
+    diff -q "$WORK/expected" "$WORK/actual" > /dev/null
+}
+
+check variable-crash-recovery crash_recovery ""
+check fixed-crash-recovery crash_recovery "" --fixed-tuples
+check pax-crash-recovery crash_recovery "" --pax-pages
+check columnar-crash-recovery crash_recovery " using columnar" --buffer-pages=16
+# every combination of the I/O paths, with a pool small enough that pages are evicted and
+# read back during the load and the recovery.
+for io_uring in "" --io-uring; do
+    for direct_io in "" --direct-io; do
+        for mmap_reads in "" --mmap-reads; do
+            flags=$(echo $io_uring $direct_io $mmap_reads)
+            [ -n "$flags" ] || continue
+            name=$(echo "$flags" | sed 's/--//g; s/ /+/g')
+            check "$name" crash_recovery "" --buffer-pages=16 $flags
+        done
+    done
+done
+check parallel parallel
+check buffercache buffercache
+check checksums checksums
+
+exit $FAILED
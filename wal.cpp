@@ -0,0 +1,332 @@
+#include "wal.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include "checksum.h"
+#include "util.h"
+
+WalManager::WalManager(const char* wal_path_arg, const char* control_path_arg)
+    : wal_path(wal_path_arg), control_path(control_path_arg) {
+    // without a control file, there was no checkpoint and the whole WAL is replayed.
+    memset(&control_data, 0, sizeof(WalControlData));
+    int control_fd = open(control_path.c_str(), O_RDONLY);
+    if (control_fd != -1) {
+        if (read(control_fd, &control_data, sizeof(WalControlData)) !=
+                (ssize_t)sizeof(WalControlData) ||
+            control_data.crc != crc32c(&control_data, offsetof(WalControlData, crc))) {
+            debug_error("control file is broken at WalManager.\n");
+        }
+        close(control_fd);
+    }
+    redo_lsn = control_data.redo_lsn;
+
+    // the WAL ends at the end of the last segment. without a segment, it starts at the redo
+    // point.
+    std::string directory_path = wal_path.substr(0, wal_path.rfind('/') + 1);
+    std::string segment_prefix = wal_path.substr(wal_path.rfind('/') + 1) + ".";
+    DIR* directory             = opendir(directory_path.c_str());
+    if (directory == nullptr) {
+        debug_error("cannot open WAL directory at WalManager.\n");
+    }
+    uint64_t first_segment = UINT64_MAX;
+    uint64_t last_segment  = 0;
+    for (struct dirent* entry = readdir(directory); entry != nullptr; entry = readdir(directory)) {
+        std::string name = entry->d_name;
+        if (name.size() != segment_prefix.size() + 16 || !name.starts_with(segment_prefix) ||
+            name.find_first_not_of("0123456789abcdef", segment_prefix.size()) != std::string::npos) {
+            continue;
+        }
+        uint64_t segment = std::stoull(name.substr(segment_prefix.size()), nullptr, 16);
+        first_segment    = std::min(first_segment, segment);
+        last_segment     = std::max(last_segment, segment);
+    }
+    closedir(directory);
+    insert_lsn  = redo_lsn;
+    old_segment = redo_lsn / WAL_SEGMENT_SIZE;
+    if (first_segment != UINT64_MAX) {
+        struct stat file_stat;
+        if (stat(segmentPath(last_segment).c_str(), &file_stat) == -1) {
+            debug_error("stat error at WalManager.\n");
+        }
+        insert_lsn  = last_segment * WAL_SEGMENT_SIZE + (uint64_t)file_stat.st_size;
+        old_segment = first_segment;
+    }
+    // the single WAL file of older versions, where lsn was the position in the file, is empty
+    // after the redo point of a clean shutdown.
+    struct stat old_wal_stat;
+    if (stat(wal_path.c_str(), &old_wal_stat) == 0) {
+        if ((uint64_t)old_wal_stat.st_size > redo_lsn) {
+            debug_error("WAL file of an older version has records to replay at WalManager.\n");
+        }
+        unlink(wal_path.c_str());
+    }
+    buffer_start_lsn = insert_lsn;
+    flushed_lsn      = insert_lsn;
+    if (insert_lsn < redo_lsn) {
+        debug_error("WAL ends before the redo point at WalManager.\n");
+    }
+}
+
+WalManager::~WalManager() {
+    flush(getInsertLsn());
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+std::string WalManager::segmentPath(uint64_t segment) {
+    char name[17];
+    snprintf(name, sizeof(name), "%016lx", segment);
+    return wal_path + "." + name;
+}
+
+void WalManager::syncDirectory() {
+    // a created, removed or truncated segment file survives a crash only after this.
+    std::string directory_path = wal_path.substr(0, wal_path.rfind('/') + 1);
+    int directory_fd           = open(directory_path.c_str(), O_RDONLY | O_DIRECTORY);
+    if (directory_fd != -1) {
+        fsync(directory_fd);
+        close(directory_fd);
+    }
+}
+
+uint64_t WalManager::readValidRecords(uint64_t start_lsn, std::vector<uint8_t>* records) {
+    std::lock_guard<std::mutex> guard(wal_lock);
+    assert(insert_buffer.empty() && insert_lsn == flushed_lsn);
+    records->clear();
+    if (start_lsn >= insert_lsn) {
+        return 0;
+    }
+    records->resize(insert_lsn - start_lsn);
+    for (size_t done = 0; done < records->size();) {
+        uint64_t lsn   = start_lsn + done;
+        size_t chunk   = std::min(records->size() - done,
+                                  (size_t)(WAL_SEGMENT_SIZE - lsn % WAL_SEGMENT_SIZE));
+        int segment_fd = open(segmentPath(lsn / WAL_SEGMENT_SIZE).c_str(), O_RDONLY);
+        if (segment_fd == -1) {
+            debug_error("WAL segment is missing at readValidRecords.\n");
+        }
+        for (size_t chunk_done = 0; chunk_done < chunk;) {
+            ssize_t read_size = pread(segment_fd, records->data() + done + chunk_done,
+                                      chunk - chunk_done,
+                                      (off_t)(lsn % WAL_SEGMENT_SIZE + chunk_done));
+            if (read_size == -1 && errno == EINTR) continue;
+            if (read_size <= 0) {
+                debug_error("failed to read WAL at readValidRecords.\n");
+            }
+            chunk_done += (size_t)read_size;
+        }
+        close(segment_fd);
+        done += chunk;
+    }
+
+    size_t valid_size = 0;
+    while (valid_size + sizeof(WalRecordHeader) <= records->size()) {
+        uint8_t* record = records->data() + valid_size;
+        WalRecordHeader header;
+        memcpy(&header, record, sizeof(WalRecordHeader));
+        if (header.lsn != start_lsn + valid_size || header.total_size < sizeof(WalRecordHeader) ||
+            header.total_size > records->size() - valid_size) {
+            break;
+        }
+        memset(record + offsetof(WalRecordHeader, crc), 0, sizeof(header.crc));
+        uint32_t crc = crc32c(record, header.total_size);
+        memcpy(record + offsetof(WalRecordHeader, crc), &header.crc, sizeof(header.crc));
+        if (crc != header.crc) {
+            break;
+        }
+        valid_size += header.total_size;
+    }
+    records->resize(valid_size);
+
+    // cut off the broken tail, which was never acknowledged as committed: the segment where the
+    // valid records end is truncated, and the later ones are removed.
+    uint64_t valid_end_lsn = start_lsn + valid_size;
+    if (valid_end_lsn < insert_lsn) {
+        uint64_t end_segment = valid_end_lsn / WAL_SEGMENT_SIZE;
+        for (uint64_t segment = end_segment; segment <= (insert_lsn - 1) / WAL_SEGMENT_SIZE;
+             segment++) {
+            if (segment > end_segment) {
+                if (unlink(segmentPath(segment).c_str()) == -1) {
+                    debug_error("failed to remove WAL segment at readValidRecords.\n");
+                }
+                continue;
+            }
+            int segment_fd = open(segmentPath(segment).c_str(), O_WRONLY);
+            if (segment_fd == -1 ||
+                ftruncate(segment_fd, (off_t)(valid_end_lsn % WAL_SEGMENT_SIZE)) == -1 ||
+                fdatasync(segment_fd) == -1) {
+                debug_error("failed to truncate WAL at readValidRecords.\n");
+            }
+            close(segment_fd);
+        }
+        syncDirectory();
+        insert_lsn       = valid_end_lsn;
+        flushed_lsn      = insert_lsn;
+        buffer_start_lsn = insert_lsn;
+    }
+    return valid_size;
+}
+
+uint64_t WalManager::insertRecord(WalRecordType type, uint8_t flags,
+                                  const std::vector<WalPayload>& payload, uint64_t page_lsn,
+                                  const std::vector<WalPayload>* full_page_payload) {
+    WalRecordHeader header;
+    memset(&header, 0, sizeof(WalRecordHeader));
+    header.type = type;
+
+    std::lock_guard<std::mutex> guard(wal_lock);
+    // redo_lsn is checked under wal_lock, so that a checkpoint cannot start in between.
+    const std::vector<WalPayload>* record_payload = &payload;
+    if (full_page_payload != nullptr && page_lsn <= redo_lsn) {
+        record_payload = full_page_payload;
+        flags |= WAL_FULL_PAGE_IMAGE;
+    }
+    header.flags      = flags;
+    header.total_size = sizeof(WalRecordHeader);
+    for (auto&& part : *record_payload) {
+        header.total_size += (uint32_t)part.size;
+    }
+    header.lsn    = insert_lsn;
+    size_t offset = insert_buffer.size();
+    insert_buffer.resize(offset + header.total_size);
+    uint8_t* record = insert_buffer.data() + offset;
+    memcpy(record, &header, sizeof(WalRecordHeader));
+    uint8_t* cur_ptr = record + sizeof(WalRecordHeader);
+    for (auto&& part : *record_payload) {
+        memcpy(cur_ptr, part.data, part.size);
+        cur_ptr += part.size;
+    }
+    header.crc = crc32c(record, header.total_size);
+    memcpy(record + offsetof(WalRecordHeader, crc), &header.crc, sizeof(header.crc));
+    insert_lsn += header.total_size;
+    ++record_count;
+    return insert_lsn;
+}
+
+void WalManager::flush(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(wal_lock);
+    // a page can be newer than the WAL when the WAL file was removed.
+    lsn = std::min(lsn, insert_lsn);
+    while (flushed_lsn < lsn) {
+        if (flushing) {
+            // another thread is the leader. its flush may cover our records too.
+            wal_cv.wait(lock);
+            continue;
+        }
+        // become the leader, and take every record inserted until now.
+        flushing = true;
+        std::vector<uint8_t> batch;
+        batch.swap(insert_buffer);
+        uint64_t batch_start_lsn = buffer_start_lsn;
+        buffer_start_lsn         = insert_lsn;
+        lock.unlock();
+
+        writeSegments(batch.data(), batch.size(), batch_start_lsn);
+
+        lock.lock();
+        flushed_lsn = batch_start_lsn + batch.size();
+        flushing    = false;
+        ++flush_count;
+        wal_cv.notify_all();
+    }
+}
+
+void WalManager::writeSegments(const uint8_t* data, size_t size, uint64_t lsn) {
+    // called by the flush leader only. a segment is durable before the next one is written to,
+    // so the WAL which survives a crash is a prefix of what was written.
+    for (size_t done = 0; done < size;) {
+        uint64_t segment = (lsn + done) / WAL_SEGMENT_SIZE;
+        if (fd == -1 || segment != fd_segment) {
+            if (fd != -1 && (fdatasync(fd) == -1 || close(fd) == -1)) {
+                debug_error("failed to fdatasync WAL at writeSegments.\n");
+            }
+            fd = open(segmentPath(segment).c_str(), O_WRONLY | O_CREAT, S_IWUSR | S_IRUSR);
+            if (fd == -1) {
+                debug_error("cannot open WAL segment at writeSegments.\n");
+            }
+            fd_segment = segment;
+            syncDirectory();
+        }
+        size_t chunk =
+            std::min(size - done, (size_t)(WAL_SEGMENT_SIZE - (lsn + done) % WAL_SEGMENT_SIZE));
+        ssize_t written =
+            pwrite(fd, data + done, chunk, (off_t)((lsn + done) % WAL_SEGMENT_SIZE));
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) {
+            debug_error("failed to write WAL at writeSegments.\n");
+        }
+        done += (size_t)written;
+    }
+    if (fdatasync(fd) == -1) {
+        debug_error("failed to fdatasync WAL at writeSegments.\n");
+    }
+}
+
+uint64_t WalManager::getInsertLsn() {
+    std::lock_guard<std::mutex> guard(wal_lock);
+    return insert_lsn;
+}
+
+std::pair<uint64_t, uint64_t> WalManager::getCounts() {
+    std::lock_guard<std::mutex> guard(wal_lock);
+    return {record_count, flush_count};
+}
+
+uint64_t WalManager::getRedoLsn() {
+    std::lock_guard<std::mutex> guard(wal_lock);
+    return redo_lsn;
+}
+
+uint64_t WalManager::startCheckpoint() {
+    // every change logged before the redo point is in a page which is already marked dirty.
+    std::lock_guard<std::mutex> guard(wal_lock);
+    redo_lsn = insert_lsn;
+    return redo_lsn;
+}
+
+void WalManager::finishCheckpoint(uint64_t checkpoint_redo_lsn) {
+    WalControlData new_control_data;
+    memset(&new_control_data, 0, sizeof(WalControlData));
+    new_control_data.redo_lsn       = checkpoint_redo_lsn;
+    new_control_data.checkpoint_num = getCheckpointNum() + 1;
+    new_control_data.crc = crc32c(&new_control_data, offsetof(WalControlData, crc));
+
+    // replace the control file atomically
+    std::string temp_path = control_path + ".tmp";
+    int control_fd =
+        open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (control_fd == -1 ||
+        write(control_fd, &new_control_data, sizeof(WalControlData)) !=
+            (ssize_t)sizeof(WalControlData) ||
+        fsync(control_fd) == -1 || close(control_fd) == -1 ||
+        rename(temp_path.c_str(), control_path.c_str()) == -1) {
+        debug_error("failed to write control file at finishCheckpoint.\n");
+    }
+    syncDirectory();
+
+    // the WAL before the redo point is never read again, so the segments which end before it
+    // are removed. a segment is kept while the flush leader may still write to it.
+    uint64_t first_segment;
+    uint64_t remove_segment;
+    {
+        std::lock_guard<std::mutex> guard(wal_lock);
+        control_data   = new_control_data;
+        first_segment  = old_segment;
+        remove_segment = std::min(checkpoint_redo_lsn, flushed_lsn) / WAL_SEGMENT_SIZE;
+        old_segment    = std::max(old_segment, remove_segment);
+    }
+    for (uint64_t segment = first_segment; segment < remove_segment; segment++) {
+        unlink(segmentPath(segment).c_str());
+    }
+}
+
+uint64_t WalManager::getCheckpointNum() {
+    std::lock_guard<std::mutex> guard(wal_lock);
+    return control_data.checkpoint_num;
+}
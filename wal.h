@@ -0,0 +1,134 @@
+#ifndef _WAL_H_
+#define _WAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+    wal record structure
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    | WalRecordHeader{total_size(32), crc(32), lsn(64), type(8), flags(8)} | payload(z) |
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    CREATE_TABLE payload: | table_info tuple(z), as copied into the schema |
+    INSERT payload:       | table_name_len(16) | table_name | block_id(64) | plain_tuple(z) |
+    INSERT payload with WAL_FULL_PAGE_IMAGE:
+                          | table_name_len(16) | table_name | block_id(64) | page after insert |
+    INSERT payload of a columnar table, one record per column of the row:
+                          | table_name_len(16) | table_name | block_id(64) | column_id(16) |
+                          | row_id(64) | field(z), or plain_tuple(z) for the last column |
+                          | block after insert, only with WAL_FULL_PAGE_IMAGE |
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    ※ lsn is the byte position of the record in the WAL, and crc is the crc32c of the whole
+      record computed with crc = 0. pd_lsn of a page is the end position of the last record
+      which changed the page, so the page may be written only after the WAL is durable up to it.
+    ※ the first change of a page after the redo point of a checkpoint logs the whole page, so
+      that recovery never depends on a page on disk which may have been torn by a crash.
+    ※ a columnar row is logged from the last column to the first, so that recovery can finish
+      a row whose later records were lost from the whole tuple in its first record.
+*/
+
+/*
+    control file structure
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    | WalControlData{redo_lsn(64), checkpoint_num(64), crc(32)} |
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    ※ written to a temporary file and renamed, so it is replaced atomically.
+*/
+
+/*
+    WAL segment files
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    | WAL.0000000000000000 | WAL.0000000000000001 | ... each WAL_SEGMENT_SIZE bytes |
+    ーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーーー
+    ※ byte lsn of the WAL is at lsn % WAL_SEGMENT_SIZE of segment lsn / WAL_SEGMENT_SIZE, so a
+      record may continue in the next segment. lsn only grows (64 bit, it does not wrap in
+      practice), and a checkpoint removes the segments which end before its redo point.
+*/
+const uint64_t WAL_SEGMENT_SIZE = 16 << 20;
+
+typedef enum class WalRecordType : uint8_t {
+    CREATE_TABLE = 1,
+    INSERT       = 2,
+} WalRecordType;
+
+// flags of an INSERT record
+const uint8_t WAL_INSERT_INIT_PAGE = 1;  // the page was empty, initialize it before the insert
+const uint8_t WAL_FULL_PAGE_IMAGE  = 2;  // the payload has the whole page instead of the tuple
+
+typedef struct WalRecordHeader {
+    uint32_t total_size;
+    uint32_t crc;
+    uint64_t lsn;
+    WalRecordType type;
+    uint8_t flags;
+} WalRecordHeader;
+
+typedef struct WalControlData {
+    uint64_t redo_lsn;  // recovery replays the WAL from here
+    uint64_t checkpoint_num;
+    uint32_t crc;
+} WalControlData;
+
+typedef struct WalPayload {
+    const void* data;
+    size_t size;
+} WalPayload;
+
+/*
+    WalManager appends records to the WAL file.
+    insertRecord only copies the record to insert_buffer and returns its end lsn. flush(lsn)
+    makes the WAL durable up to lsn with group commit: the first thread which has to flush
+    becomes the leader, and writes and fdatasyncs everything inserted so far at once, while
+    the threads which need a flush in the meantime wait for it and usually find their records
+    already durable when it is done.
+    At startup, readValidRecords returns the records for recovery. The WAL ends at the first
+    record which is torn or broken, and the rest is cut off, so that new records follow the
+    last valid one. It must be called before any record is inserted.
+    A checkpoint takes its redo point with startCheckpoint, and when every page changed before
+    it is durable, finishCheckpoint stores it in the control file and removes the segments
+    before it.
+*/
+class WalManager {
+   public:
+    WalManager(const char* wal_path_arg, const char* control_path_arg);
+    virtual ~WalManager();
+    uint64_t readValidRecords(uint64_t start_lsn, std::vector<uint8_t>* records);
+    uint64_t insertRecord(WalRecordType type, uint8_t flags, const std::vector<WalPayload>& payload,
+                          uint64_t page_lsn                                = 0,
+                          const std::vector<WalPayload>* full_page_payload = nullptr);
+    void flush(uint64_t lsn);
+    uint64_t getInsertLsn();
+    uint64_t getRedoLsn();
+    uint64_t startCheckpoint();
+    void finishCheckpoint(uint64_t redo_lsn);
+    std::pair<uint64_t, uint64_t> getCounts();  // number of records and of fdatasync
+    uint64_t getCheckpointNum();
+
+   private:
+    std::string segmentPath(uint64_t segment);
+    void writeSegments(const uint8_t* data, size_t size, uint64_t lsn);
+    void syncDirectory();
+    std::string wal_path;  // segment n is wal_path + "." + n in 16 hex digits
+    std::string control_path;
+    int fd              = -1;  // segment being written, only used by the flush leader
+    uint64_t fd_segment = 0;
+    std::mutex wal_lock;  // protects every member below
+    WalControlData control_data;  // last completed checkpoint
+    std::condition_variable wal_cv;
+    std::vector<uint8_t> insert_buffer;  // records from buffer_start_lsn which are not written
+    uint64_t buffer_start_lsn;
+    uint64_t insert_lsn;   // end of the last inserted record
+    uint64_t flushed_lsn;  // the WAL is durable up to here
+    uint64_t redo_lsn;     // redo point of the running or the last checkpoint
+    uint64_t old_segment;  // no segment before this one exists
+    bool flushing         = false;
+    uint64_t record_count = 0;
+    uint64_t flush_count  = 0;  // number of fdatasync
+};
+
+#endif